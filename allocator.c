@@ -0,0 +1,110 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "allocator.h"
+
+static void *malloc_alloc(void *user_data, size_t size) {
+  (void)user_data;
+  return malloc(size);
+}
+
+static void *malloc_realloc(void *user_data, void *ptr, size_t old_size,
+                            size_t new_size) {
+  (void)user_data;
+  (void)old_size;
+  return realloc(ptr, new_size);
+}
+
+static void malloc_free(void *user_data, void *ptr, size_t size) {
+  (void)user_data;
+  (void)size;
+  free(ptr);
+}
+
+const GmmAllocator gmm_malloc_allocator = {malloc_alloc, malloc_realloc,
+                                           malloc_free, NULL};
+
+// Counts size more bytes as used, unless that exceeds the limit
+static bool budget_reserve(GmmMemoryBudget *budget, size_t size) {
+  size_t used = atomic_load(&budget->used);
+  do {
+    if (budget->limit > 0 &&
+        (used > budget->limit || size > budget->limit - used)) {
+      atomic_fetch_add(&budget->refused, 1);
+      return false;
+    }
+  } while (!atomic_compare_exchange_weak(&budget->used, &used, used + size));
+  size_t peak = atomic_load(&budget->peak);
+  while (used + size > peak &&
+         !atomic_compare_exchange_weak(&budget->peak, &peak, used + size))
+    ;
+  return true;
+}
+
+static void budget_release(GmmMemoryBudget *budget, size_t size) {
+  atomic_fetch_sub(&budget->used, size);
+}
+
+static void *budget_alloc(void *user_data, size_t size) {
+  GmmMemoryBudget *budget = user_data;
+  if (!budget_reserve(budget, size))
+    return NULL;
+  void *ptr = gmm_alloc(budget->parent, size);
+  if (ptr == NULL)
+    budget_release(budget, size);
+  return ptr;
+}
+
+static void *budget_realloc(void *user_data, void *ptr, size_t old_size,
+                            size_t new_size) {
+  GmmMemoryBudget *budget = user_data;
+  // growing takes the difference from the budget up front
+  if (new_size > old_size && !budget_reserve(budget, new_size - old_size))
+    return NULL;
+  void *result = gmm_realloc(budget->parent, ptr, old_size, new_size);
+  if (result == NULL) {
+    if (new_size > old_size)
+      budget_release(budget, new_size - old_size);
+  } else if (new_size < old_size) {
+    budget_release(budget, old_size - new_size);
+  }
+  return result;
+}
+
+static void budget_free(void *user_data, void *ptr, size_t size) {
+  GmmMemoryBudget *budget = user_data;
+  gmm_free(budget->parent, ptr, size);
+  budget_release(budget, size);
+}
+
+void gmm_budget_init(GmmMemoryBudget *budget, const GmmAllocator *parent,
+                     size_t limit) {
+  budget->allocator.alloc = budget_alloc;
+  budget->allocator.realloc = budget_realloc;
+  budget->allocator.free = budget_free;
+  budget->allocator.user_data = budget;
+  budget->parent = parent != NULL ? parent : &gmm_malloc_allocator;
+  budget->limit = limit;
+  atomic_init(&budget->used, 0);
+  atomic_init(&budget->peak, 0);
+  atomic_init(&budget->refused, 0);
+}
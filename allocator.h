@@ -0,0 +1,75 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Memory allocator of the library. Arenas, arrays and the decoder get their
+// memory through one of these, so a program can account for it or put it
+// under a budget. The sizes passed to realloc and free are the ones the
+// memory was allocated with, so an allocator doesn't have to record them.
+typedef struct GmmAllocator {
+  // Returns NULL when out of memory. The memory has to be suitably aligned
+  // for any type, like malloc's.
+  void *(*alloc)(void *user_data, size_t size);
+  void *(*realloc)(void *user_data, void *ptr, size_t old_size,
+                   size_t new_size);
+  void (*free)(void *user_data, void *ptr, size_t size);
+  void *user_data;
+} GmmAllocator;
+
+// malloc, realloc and free. Used wherever no allocator is given.
+extern const GmmAllocator gmm_malloc_allocator;
+
+static inline void *gmm_alloc(const GmmAllocator *allocator, size_t size) {
+  return allocator->alloc(allocator->user_data, size);
+}
+
+static inline void *gmm_realloc(const GmmAllocator *allocator, void *ptr,
+                                size_t old_size, size_t new_size) {
+  return allocator->realloc(allocator->user_data, ptr, old_size, new_size);
+}
+
+static inline void gmm_free(const GmmAllocator *allocator, void *ptr,
+                            size_t size) {
+  if (ptr != NULL)
+    allocator->free(allocator->user_data, ptr, size);
+}
+
+// Allocator that keeps track of the memory in use and refuses allocations
+// that would take it over a limit. The memory comes from a parent
+// allocator. Can be shared by any number of threads, and must not be moved
+// after gmm_budget_init.
+typedef struct GmmMemoryBudget {
+  GmmAllocator allocator; // pass this one to sessions
+  const GmmAllocator *parent;
+  size_t limit; // 0 for no limit
+  atomic_size_t used;
+  atomic_size_t peak;     // highest value of used so far
+  atomic_size_t refused;  // allocations that failed because of the limit
+} GmmMemoryBudget;
+
+// parent NULL takes the memory from malloc.
+void gmm_budget_init(GmmMemoryBudget *budget, const GmmAllocator *parent,
+                     size_t limit);
+
+#endif // ALLOCATOR_H
@@ -0,0 +1,169 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN (_Alignof(max_align_t))
+
+static size_t align_offset(const ArenaBlock *block, size_t offset) {
+  uintptr_t addr = (uintptr_t)(block->data + offset);
+  uintptr_t aligned = (addr + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1);
+  return offset + (aligned - addr);
+}
+
+static ArenaBlock *new_block(Arena *arena, size_t size) {
+  // reserve room for aligning the first allocation
+  ArenaBlock *block =
+      gmm_alloc(arena->allocator, sizeof(ArenaBlock) + size + ARENA_ALIGN);
+  if (block == NULL)
+    return NULL;
+  block->next = NULL;
+  block->size = size + ARENA_ALIGN;
+  block->used = 0;
+  return block;
+}
+
+static void free_block(Arena *arena, ArenaBlock *block) {
+  gmm_free(arena->allocator, block, sizeof(ArenaBlock) + block->size);
+}
+
+void arena_init(Arena *arena, size_t block_size) {
+  arena_init_with(arena, block_size, NULL);
+}
+
+void arena_init_with(Arena *arena, size_t block_size,
+                     const GmmAllocator *allocator) {
+  arena->head = NULL;
+  arena->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+  arena->last_alloc = NULL;
+  arena->allocator = allocator != NULL ? allocator : &gmm_malloc_allocator;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+  ArenaBlock *block = arena->head;
+  if (block != NULL) {
+    size_t start = align_offset(block, block->used);
+    if (start <= block->size && block->size - start >= size) {
+      block->used = start + size;
+      arena->last_alloc = block->data + start;
+      return arena->last_alloc;
+    }
+  }
+
+  if (size > arena->block_size / 4) {
+    // Big allocations get a block of their own. It is put behind the head,
+    // so the free space of the head block isn't lost.
+    ArenaBlock *big = new_block(arena, size);
+    if (big == NULL)
+      return NULL;
+    size_t start = align_offset(big, 0);
+    big->used = start + size;
+    if (block != NULL) {
+      big->next = block->next;
+      block->next = big;
+    } else {
+      arena->head = big;
+    }
+    arena->last_alloc = NULL;
+    return big->data + start;
+  }
+
+  block = new_block(arena, arena->block_size);
+  if (block == NULL)
+    return NULL;
+  block->next = arena->head;
+  arena->head = block;
+  size_t start = align_offset(block, 0);
+  block->used = start + size;
+  arena->last_alloc = block->data + start;
+  return arena->last_alloc;
+}
+
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size,
+                    size_t new_size) {
+  if (ptr == NULL)
+    return arena_alloc(arena, new_size);
+  if (new_size <= old_size)
+    return ptr;
+  ArenaBlock *block = arena->head;
+  if (ptr == arena->last_alloc && block != NULL) {
+    size_t start = (size_t)((unsigned char *)ptr - block->data);
+    if (block->size - start >= new_size) {
+      block->used = start + new_size;
+      return ptr;
+    }
+  }
+  void *result = arena_alloc(arena, new_size);
+  if (result == NULL)
+    return NULL;
+  memcpy(result, ptr, old_size);
+  return result;
+}
+
+void arena_adopt(Arena *arena, Arena *src) {
+  if (src->head == NULL)
+    return;
+  ArenaBlock *tail = src->head;
+  while (tail->next != NULL)
+    tail = tail->next;
+  if (arena->head == NULL) {
+    arena->head = src->head;
+    arena->last_alloc = src->last_alloc;
+  } else {
+    // keep allocating from our own head block
+    tail->next = arena->head->next;
+    arena->head->next = src->head;
+  }
+  src->head = NULL;
+  src->last_alloc = NULL;
+}
+
+void arena_reset(Arena *arena) {
+  ArenaBlock *keep = NULL;
+  ArenaBlock *block = arena->head;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    if (keep == NULL && block->size == arena->block_size + ARENA_ALIGN) {
+      keep = block;
+    } else {
+      free_block(arena, block);
+    }
+    block = next;
+  }
+  if (keep != NULL) {
+    keep->next = NULL;
+    keep->used = 0;
+  }
+  arena->head = keep;
+  arena->last_alloc = NULL;
+}
+
+void arena_release(Arena *arena) {
+  ArenaBlock *block = arena->head;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    free_block(arena, block);
+    block = next;
+  }
+  arena->head = NULL;
+  arena->last_alloc = NULL;
+}
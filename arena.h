@@ -0,0 +1,65 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#include "allocator.h"
+
+// Region allocator. Memory is carved out of a few big blocks and can only be
+// released all at once with arena_release.
+#define ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock {
+  struct ArenaBlock *next;
+  size_t size; // usable bytes in data
+  size_t used;
+  unsigned char data[];
+} ArenaBlock;
+
+typedef struct Arena {
+  ArenaBlock *head; // block new allocations are taken from
+  size_t block_size;
+  void *last_alloc; // most recent allocation, can be grown in place
+  const GmmAllocator *allocator; // of the blocks
+} Arena;
+
+// Takes the blocks from malloc
+void arena_init(Arena *arena, size_t block_size);
+// Takes the blocks from allocator, NULL uses malloc
+void arena_init_with(Arena *arena, size_t block_size,
+                     const GmmAllocator *allocator);
+// Returns NULL when out of memory. The memory is suitably aligned for any
+// type.
+void *arena_alloc(Arena *arena, size_t size);
+// Grows ptr (which has old_size bytes) to new_size bytes. The last allocation
+// is extended in place if there is room, otherwise the data is copied.
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+// Moves all blocks of src into arena, src is empty afterwards. Allocations
+// made from src stay valid and are released together with arena. Both
+// arenas have to use the same allocator.
+void arena_adopt(Arena *arena, Arena *src);
+// Releases all memory, except one block that is kept for reuse.
+void arena_reset(Arena *arena);
+// Releases all memory of the arena.
+void arena_release(Arena *arena);
+
+#endif // ARENA_H
@@ -0,0 +1,220 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#include <dirent.h>
+#include <errno.h>
+#include <glob.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "arena.h"
+#include "batch.h"
+#include "dynarray.h"
+#include "threadpool.h"
+
+// One file of the batch
+struct BatchJob {
+  const char *path;
+  const char *out_path;
+  const ConvertOptions *opts;
+  GmmError error;
+  double seconds;
+};
+
+DYNARRAY(BatchJobArray, struct BatchJob, batch_job_array)
+
+struct Batch {
+  Arena arena; // paths and jobs
+  BatchJobArray jobs;
+  const char *out_dir;
+  const ConvertOptions *opts;
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static char *arena_strdup(Arena *arena, const char *str) {
+  size_t len = strlen(str);
+  char *copy = arena_alloc(arena, len + 1);
+  if (copy != NULL)
+    memcpy(copy, str, len + 1);
+  return copy;
+}
+
+static bool has_gmm_extension(const char *name) {
+  size_t len = strlen(name);
+  return len > 4 && strcmp(name + len - 4, ".gmm") == 0;
+}
+
+// Queues the file at path, it is written to out_dir under its base name.
+static RESULT add_file(struct Batch *batch, const char *path) {
+  const char *base = strrchr(path, '/');
+  base = base != NULL ? base + 1 : path;
+  size_t base_len = has_gmm_extension(base) ? strlen(base) - 4 : strlen(base);
+  const char *ext = batch->opts->format == FORMAT_GMMB ? "gmmb" : "json";
+  size_t out_size = strlen(batch->out_dir) + base_len + 8;
+  char *out_path = arena_alloc(&batch->arena, out_size);
+  struct BatchJob *job = batch_job_array_push(&batch->jobs);
+  if (out_path == NULL || job == NULL)
+    return RES_OUT_OF_MEMORY;
+  snprintf(out_path, out_size, "%s/%.*s.%s", batch->out_dir, (int)base_len,
+           base, ext);
+  job->path = arena_strdup(&batch->arena, path);
+  job->out_path = out_path;
+  job->opts = batch->opts;
+  job->error.code = RES_OK;
+  job->error.message[0] = '\0';
+  job->seconds = 0;
+  return job->path != NULL ? RES_OK : RES_OUT_OF_MEMORY;
+}
+
+// Queues the .gmm files of a directory, without descending into
+// subdirectories.
+static RESULT add_directory(struct Batch *batch, const char *path) {
+  DIR *dir = opendir(path);
+  if (dir == NULL)
+    return add_file(batch, path); // fails with the reason when converted
+  RESULT res = RES_OK;
+  struct dirent *entry;
+  while (res == RES_OK && (entry = readdir(dir)) != NULL) {
+    if (!has_gmm_extension(entry->d_name))
+      continue;
+    size_t size = strlen(path) + strlen(entry->d_name) + 2;
+    char *file = arena_alloc(&batch->arena, size);
+    if (file == NULL) {
+      res = RES_OUT_OF_MEMORY;
+      break;
+    }
+    snprintf(file, size, "%s/%s", path, entry->d_name);
+    res = add_file(batch, file);
+  }
+  closedir(dir);
+  return res;
+}
+
+static RESULT add_input(struct Batch *batch, const char *input) {
+  struct stat st;
+  if (stat(input, &st) == 0)
+    return S_ISDIR(st.st_mode) ? add_directory(batch, input)
+                               : add_file(batch, input);
+  // quoted patterns that the shell didn't expand
+  glob_t matches;
+  if (strpbrk(input, "*?[") == NULL ||
+      glob(input, 0, NULL, &matches) != 0)
+    return add_file(batch, input);
+  RESULT res = RES_OK;
+  for (size_t i = 0; i < matches.gl_pathc && res == RES_OK; ++i)
+    res = add_file(batch, matches.gl_pathv[i]);
+  globfree(&matches);
+  return res;
+}
+
+static int compare_jobs(const void *a, const void *b) {
+  const struct BatchJob *job_a = a;
+  const struct BatchJob *job_b = b;
+  int order = strcmp(job_a->out_path, job_b->out_path);
+  return order != 0 ? order : strcmp(job_a->path, job_b->path);
+}
+
+static void convert_job(void *arg) {
+  struct BatchJob *job = arg;
+  double start = now();
+  convert_file(job->path, job->out_path, job->opts, &job->error);
+  job->seconds = now() - start;
+}
+
+int convert_batch(char **inputs, size_t num_inputs, const char *out_dir,
+                  const ConvertOptions *opts, unsigned int threads) {
+  double start = now();
+  // Every file is decoded on a single thread, the files are the unit of
+  // parallelism
+  ConvertOptions file_opts = *opts;
+  file_opts.threads = 1;
+  struct Batch batch;
+  arena_init(&batch.arena, ARENA_DEFAULT_BLOCK_SIZE);
+  RESULT res = batch_job_array_init_in(&batch.jobs, &batch.arena, 16);
+  batch.out_dir = out_dir;
+  batch.opts = &file_opts;
+  int status = EXIT_FAILURE;
+
+  if (mkdir(out_dir, 0777) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Couldn't create %s: %s\n", out_dir, strerror(errno));
+    goto done;
+  }
+  for (size_t i = 0; i < num_inputs && res == RES_OK; ++i)
+    res = add_input(&batch, inputs[i]);
+  if (res < 0) {
+    fprintf(stderr, "Out of memory\n");
+    goto done;
+  }
+  size_t count = batch.jobs.len;
+  struct BatchJob *jobs = batch.jobs.data;
+  qsort(jobs, count, sizeof(struct BatchJob), compare_jobs);
+  // A file given twice (e.g. by a directory and a pattern) is converted once
+  size_t unique = count > 0 ? 1 : 0;
+  for (size_t i = 1; i < count; ++i) {
+    if (strcmp(jobs[i].path, jobs[unique - 1].path) != 0)
+      jobs[unique++] = jobs[i];
+  }
+  count = unique;
+  // Two inputs with the same name would overwrite each other's output
+  for (size_t i = 1; i < count; ++i) {
+    if (strcmp(jobs[i].out_path, jobs[i - 1].out_path) == 0)
+      gmm_set_error(&jobs[i].error, RES_ERR, "%s is already written by %s",
+                    jobs[i].out_path, jobs[i - 1].path);
+  }
+
+  ThreadPool *pool =
+      threadpool_create(count < threads ? (unsigned int)count : threads);
+  if (pool == NULL) {
+    fprintf(stderr, "Couldn't start the conversion threads\n");
+    goto done;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (jobs[i].error.code < 0)
+      continue;
+    if (threadpool_submit(pool, convert_job, &jobs[i]) < 0)
+      gmm_set_error(&jobs[i].error, RES_OUT_OF_MEMORY, "Out of memory");
+  }
+  threadpool_destroy(pool);
+
+  size_t failed = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (jobs[i].error.code < 0) {
+      fprintf(stderr, "failed %s: %s\n", jobs[i].path, jobs[i].error.message);
+      failed++;
+    } else {
+      fprintf(stderr, "ok     %s -> %s (%.1f ms)\n", jobs[i].path,
+              jobs[i].out_path, jobs[i].seconds * 1000);
+    }
+  }
+  fprintf(stderr, "Converted %zu of %zu files in %.2f s\n", count - failed,
+          count, now() - start);
+  status = failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+done:
+  arena_release(&batch.arena);
+  return status;
+}
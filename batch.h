@@ -0,0 +1,35 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+
+#include "convert.h"
+
+// Converts every input into out_dir. An input is a .gmm file, a directory
+// whose .gmm files are converted, or a glob pattern like "maps/*.gmm". The
+// files are converted in parallel on a pool of threads, map.gmm becomes
+// out_dir/map.json (or map.gmmb). Prints the result of every file and a
+// summary to stderr. Returns EXIT_SUCCESS if all files were converted.
+int convert_batch(char **inputs, size_t num_inputs, const char *out_dir,
+                  const ConvertOptions *opts, unsigned int threads);
+
+#endif // BATCH_H
@@ -0,0 +1,967 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "convert.h"
+#include "gmmb_writer.h"
+#include "trace.h"
+#include "xxh64.h"
+
+#define JSOBJ_UINT(out, ck, prop)                                              \
+  json_key((out), #prop);                                                      \
+  json_uint((out), (ck).prop)
+#define JSOBJ_STR(out, ck, prop)                                               \
+  json_key((out), #prop);                                                      \
+  json_string((out), (ck).prop.str, (ck).prop.len)
+#define JSOBJ_INT(out, ck, prop)                                               \
+  json_key((out), #prop);                                                      \
+  json_int((out), (ck).prop)
+
+// Writes one layer of a LVL_CELL chunk. Returns false if it can't be decoded.
+static bool export_layer(JsonWriter *result, RiffChunkLevelCell *cell,
+                         GmmCellLayer l, const ConvertOptions *opts) {
+  json_key(result, cell_layer_to_str(l));
+  if (opts->cells == CELLS_RLE) {
+    // passed through from the file data without decoding it
+    GmmStoredLayer stored;
+    if (gmm_cell_layer_stored(cell, l, &stored) < 0) {
+      gmm_set_error(cell->error, RES_BAD_INPUT,
+                    "Unexpected compression type of cell layer %s.",
+                    cell_layer_to_str(l));
+      return false;
+    }
+    const char *encoding = stored.compression == GMM_CELLS_RLE    ? "rle-base64"
+                           : stored.compression == GMM_CELLS_ZERO ? "zero"
+                                                                  : "base64";
+    json_begin_object(result);
+    json_key(result, "encoding");
+    json_string(result, encoding, strlen(encoding));
+    json_key(result, "data");
+    json_base64(result, stored.data, stored.len);
+    json_end_object(result);
+    return true;
+  }
+
+  const uint8 *layer = gmm_cell_layer(cell, l);
+  if (layer == NULL)
+    return false;
+  if (opts->cells == CELLS_BASE64) {
+    json_begin_object(result);
+    json_key(result, "encoding");
+    json_string(result, "base64", 6);
+    json_key(result, "data");
+    json_base64(result, layer, cell->cells_count);
+    json_end_object(result);
+  } else {
+    json_uint8_array(result, layer, cell->cells_count);
+  }
+  return true;
+}
+
+RESULT export_gmm(JsonWriter *result, GmmChunk *ck,
+                  const ConvertOptions *opts) {
+  json_begin_object(result);
+  json_key(result, "chunk_type");
+  const char *ck_type = chunk_type_to_str(ck->ctype);
+  json_string(result, ck_type, strlen(ck_type));
+
+  switch (ck->ctype) {
+  case GMM_LIST:
+    json_key(result, "list_type");
+    json_string(result, (const char *)ck->list_chunk.ckType, 4);
+    size_t child_count = ck->list_chunk.children.len;
+    json_key(result, "children");
+    json_begin_array(result);
+    // the children of "lvls" are the levels, which are traced one by one
+    bool trace_levels =
+        opts->trace != NULL &&
+        gmm_fourcc(ck->list_chunk.ckType) == GMM_FOURCC('l', 'v', 'l', 's');
+
+    for (size_t i = 0; i < child_count; ++i) {
+      GmmChunk *child = &ck->list_chunk.children.data[i];
+      uint64_t start = trace_levels ? gmm_trace_now() : 0;
+      RESULT res = export_gmm(result, child, opts);
+      if (res < 0)
+        return res;
+      if (trace_levels && child->ctype == GMM_LIST)
+        gmm_trace_level(opts->trace, GMM_STAGE_WRITE,
+                        child->list_chunk.level_index, start);
+    }
+    json_end_array(result);
+    break;
+  case GMM_MAP_PROP:
+    JSOBJ_UINT(result, ck->map_prop_chunk, version);
+    JSOBJ_STR(result, ck->map_prop_chunk, title);
+    JSOBJ_STR(result, ck->map_prop_chunk, game);
+    JSOBJ_STR(result, ck->map_prop_chunk, author);
+    JSOBJ_STR(result, ck->map_prop_chunk, creation_time);
+    JSOBJ_STR(result, ck->map_prop_chunk, notes);
+    break;
+  case GMM_MAP_COOR:
+    JSOBJ_UINT(result, ck->map_coor_chunk, origin);
+    JSOBJ_UINT(result, ck->map_coor_chunk, row_style);
+    JSOBJ_UINT(result, ck->map_coor_chunk, column_style);
+    JSOBJ_UINT(result, ck->map_coor_chunk, row_start);
+    JSOBJ_UINT(result, ck->map_coor_chunk, column_start);
+    break;
+  case GMM_LVL_PROP:
+    JSOBJ_STR(result, ck->level_prop_chunk, location_name);
+    JSOBJ_STR(result, ck->level_prop_chunk, level_name);
+    JSOBJ_INT(result, ck->level_prop_chunk, elevation);
+    JSOBJ_UINT(result, ck->level_prop_chunk, num_rows);
+    JSOBJ_UINT(result, ck->level_prop_chunk, num_columns);
+    JSOBJ_UINT(result, ck->level_prop_chunk, override_coord_opts);
+    JSOBJ_STR(result, ck->level_prop_chunk, notes);
+    break;
+  case GMM_LVL_COOR:
+    JSOBJ_UINT(result, ck->level_coor_chunk, origin);
+    JSOBJ_UINT(result, ck->level_coor_chunk, row_style);
+    JSOBJ_UINT(result, ck->level_coor_chunk, column_style);
+    JSOBJ_UINT(result, ck->level_coor_chunk, row_start);
+    JSOBJ_UINT(result, ck->level_coor_chunk, column_start);
+    break;
+  case GMM_LVL_CELL:
+    for (int l = 0; l < GMM_LAYER_COUNT; ++l) {
+      if (!(ck->level_cell_chunk.layer_mask & GMM_LAYER_BIT(l)))
+        continue;
+      if (!export_layer(result, &ck->level_cell_chunk, l, opts))
+        return ck->level_cell_chunk.error->code;
+    }
+    break;
+  case GMM_LVL_ANNO:
+    JSOBJ_UINT(result, ck->level_anno_chunk, num_annotations);
+    size_t anno_count = ck->level_anno_chunk.num_annotations;
+    json_key(result, "records");
+    json_begin_array(result);
+    for (size_t i = 0; i < anno_count; ++i) {
+      AnnotationRecord *record = &ck->level_anno_chunk.records[i];
+      json_begin_object(result);
+      JSOBJ_UINT(result, *record, row);
+      JSOBJ_UINT(result, *record, column);
+      JSOBJ_UINT(result, *record, kind);
+      JSOBJ_STR(result, *record, text);
+      switch (record->kind) {
+      case AK_COMMENT:
+        break;
+      case AK_INDEXED:
+        JSOBJ_UINT(result, record->indexed, index);
+        JSOBJ_UINT(result, record->indexed, index_color);
+        break;
+      case AK_CUSTOM:
+        JSOBJ_STR(result, record->custom, custom_id);
+        break;
+      case AK_ICON:
+        JSOBJ_UINT(result, record->icon, icon);
+        break;
+      case AK_LABEL:
+        JSOBJ_UINT(result, record->label, label_color);
+        break;
+      }
+      json_end_object(result);
+    }
+    json_end_array(result);
+    break;
+  case GMM_LVL_REGN:
+    JSOBJ_UINT(result, ck->level_regn_chunk, enable_regions);
+    JSOBJ_UINT(result, ck->level_regn_chunk, rows_per_region);
+    JSOBJ_UINT(result, ck->level_regn_chunk, columns_per_region);
+    JSOBJ_UINT(result, ck->level_regn_chunk, per_region_coords);
+    JSOBJ_UINT(result, ck->level_regn_chunk, num_regions);
+    const size_t regn_count = ck->level_regn_chunk.num_regions;
+    json_key(result, "records");
+    json_begin_array(result);
+    for (size_t i = 0; i < regn_count; ++i) {
+      const LevelRegionRecord *record = &ck->level_regn_chunk.records[i];
+      json_begin_object(result);
+      JSOBJ_STR(result, *record, name);
+      JSOBJ_STR(result, *record, notes);
+      json_end_object(result);
+    }
+    json_end_array(result);
+    break;
+  case GMM_MAP_LINKS:
+    JSOBJ_UINT(result, ck->map_links_chunk, num_links);
+    const size_t links_count = ck->map_links_chunk.num_links;
+    json_key(result, "records");
+    json_begin_array(result);
+    for (size_t i = 0; i < links_count; ++i) {
+      const MapLinksRecord *record = &ck->map_links_chunk.records[i];
+      json_begin_object(result);
+      JSOBJ_UINT(result, *record, src_level_index);
+      JSOBJ_UINT(result, *record, src_row);
+      JSOBJ_UINT(result, *record, src_column);
+      JSOBJ_UINT(result, *record, dest_level_index);
+      JSOBJ_UINT(result, *record, dest_row);
+      JSOBJ_UINT(result, *record, dest_column);
+      json_end_object(result);
+    }
+    json_end_array(result);
+    break;
+  case GMM_CUSTOM:
+    json_key(result, "ck_id");
+    json_string(result, (const char *)ck->custom_chunk.head.ckId, 4);
+    break;
+  case GMM_UNKNOWN:
+    break;
+  }
+
+  json_end_object(result);
+  return RES_OK;
+}
+
+// The session and the decoded chunks of a map
+struct LoadedMap {
+  Context ctx;
+  GmmSession session;
+  RiffFile data;
+  GmmChunkArray chunks;
+};
+
+// Reads the file at path, "-" reads stdin. Files are mapped if mapped is
+// true. On failure the map is released again and the reason is in
+// map->session.error. The allocator and trace of opts are kept in the
+// session for the following steps.
+static RESULT read_map(struct LoadedMap *map, const char *path, bool mapped,
+                       const ConvertOptions *opts) {
+  bool from_stdin = strcmp(path, "-") == 0;
+  map->ctx.file_name = from_stdin ? "<stdin>" : (char *)path;
+  gmm_session_init_with(&map->session, opts->allocator);
+  GmmSession *session = &map->session;
+  GmmTrace *trace = opts->trace;
+  session->trace = trace;
+  uint64_t start = trace != NULL ? gmm_trace_now() : 0;
+  RESULT res;
+  if (from_stdin) {
+    res = read_riff(stdin, &map->ctx, session, &map->data);
+  } else if (mapped) {
+    res = map_riff(path, &map->ctx, session, &map->data);
+  } else {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+      gmm_set_error(&session->error, RES_ERR, "Cannot open file %s", path);
+      res = RES_ERR;
+    } else {
+      res = read_riff(file, &map->ctx, session, &map->data);
+      fclose(file);
+    }
+  }
+  if (res < 0)
+    gmm_session_release(session);
+  else if (trace != NULL)
+    gmm_trace_stage(trace, GMM_STAGE_READ, map->ctx.file_name, start,
+                    map->data.length);
+  return res;
+}
+
+// Decodes the chunks of a map that was read with read_map. With lazy_cells,
+// a single thread leaves the cell layers to the export, which fails halfway
+// through its output if a layer is damaged.
+static RESULT decode_map(struct LoadedMap *map, const ConvertOptions *opts,
+                         bool lazy_cells) {
+  GmmSession *session = &map->session;
+  // The data stays mapped until the output is written, so strings can point
+  // into it
+  session->flags |= GMM_DECODE_STRING_VIEWS;
+  session->threads = opts->threads > 0 ? opts->threads : 1;
+  session->selection = opts->selection;
+  // With a single thread, layers are decoded when they are exported.
+  // Otherwise they are decoded in parallel with the rest of their level.
+  if (session->threads == 1 && lazy_cells)
+    session->flags |= GMM_DECODE_LAZY_CELLS;
+  uint64_t start = session->trace != NULL ? gmm_trace_now() : 0;
+  RESULT res = decode_chunks(&map->data, session, &map->chunks);
+  if (res == RES_OK && session->trace != NULL)
+    gmm_trace_stage(session->trace, GMM_STAGE_DECODE, map->ctx.file_name,
+                    start, map->data.length);
+  return res;
+}
+
+// Reads and decodes the file at path. On failure the map is released again
+// and the reason is in map->session.error.
+static RESULT load_map(struct LoadedMap *map, const char *path,
+                       const ConvertOptions *opts) {
+  if (read_map(map, path, true, opts) < 0)
+    return map->session.error.code;
+  if (decode_map(map, opts, true) < 0) {
+    gmm_session_release(&map->session);
+    free_gmmfile(&map->data);
+    return map->session.error.code;
+  }
+  return RES_OK;
+}
+
+// Releases the map and returns its error code, after copying the error to
+// *error.
+static RESULT release_map(struct LoadedMap *map, GmmError *error) {
+  RESULT res = map->session.error.code;
+  if (res < 0 && error != NULL)
+    *error = map->session.error;
+  if (map->session.trace != NULL)
+    gmm_trace_arena(map->session.trace, &map->session.arena);
+  gmm_session_release(&map->session);
+  free_gmmfile(&map->data);
+  return res;
+}
+
+static int create_file(const char *path, GmmError *error) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+    gmm_set_error(error, RES_ERR, "Couldn't create %s: %s", path,
+                  strerror(errno));
+  return fd;
+}
+
+// Files are written under a temporary name and renamed when they are
+// complete, so a conversion that fails halfway leaves no truncated file, and
+// other processes (e.g. a game that loads level files while they are
+// updated) never see half of one. This makes the temporary name for path.
+static void temp_path(char *temp, size_t size, const char *path) {
+  static atomic_uint next_temp;
+  snprintf(temp, size, "%s.%ld.%u.tmp", path, (long)getpid(),
+           atomic_fetch_add(&next_temp, 1));
+}
+
+// Renames the temporary file to path if res is RES_OK, removes it otherwise.
+static RESULT finish_temp(const char *temp, const char *path, RESULT res,
+                          GmmError *error) {
+  if (res == RES_OK && rename(temp, path) != 0) {
+    gmm_set_error(error, RES_ERR, "Couldn't write %s: %s", path,
+                  strerror(errno));
+    res = RES_ERR;
+  }
+  if (res < 0)
+    unlink(temp);
+  return res;
+}
+
+// Writes the chunks as a JSON array to fd. The size of the output is stored
+// in *written.
+static RESULT write_json(int fd, GmmChunkArray *chunks,
+                         const ConvertOptions *opts, uint64_t *written,
+                         GmmError *error) {
+  JsonWriter *out = malloc(sizeof(JsonWriter));
+  if (out == NULL) {
+    gmm_set_error(error, RES_OUT_OF_MEMORY, "Out of memory");
+    return RES_OUT_OF_MEMORY;
+  }
+  // The chunks are written out while the tree is walked, in blocks of
+  // JSON_WRITER_BUFFER_SIZE bytes
+  json_writer_init(out, fd);
+  json_begin_array(out);
+  RESULT res = RES_OK;
+  for (size_t i = 0; i < chunks->len && res == RES_OK; ++i)
+    res = export_gmm(out, &chunks->data[i], opts);
+  // a failed conversion leaves the output unterminated
+  if (res == RES_OK) {
+    json_end_array(out);
+    json_raw(out, "\n", 1);
+  }
+  if (json_writer_flush(out) < 0 && res == RES_OK) {
+    gmm_set_error(error, RES_ERR, "Couldn't write the output");
+    res = RES_ERR;
+  }
+  *written = out->bytes_written;
+  free(out);
+  return res;
+}
+
+// Writes the decoded map to out_path, or to stdout if it is NULL. The size
+// of the output is stored in *written, 0 if it isn't known.
+static RESULT write_map(struct LoadedMap *map, const char *out_path,
+                        const ConvertOptions *opts, uint64_t *written,
+                        GmmError *error) {
+  *written = 0;
+  if (opts->format == FORMAT_GMMB) {
+    FILE *out = out_path != NULL ? fopen(out_path, "wb") : stdout;
+    if (out == NULL) {
+      gmm_set_error(error, RES_ERR, "Couldn't create %s: %s", out_path,
+                    strerror(errno));
+      return RES_ERR;
+    }
+    RESULT res = write_gmmb(out, &map->chunks, &map->session);
+    long size = ftell(out); // fails on pipes
+    *written = size > 0 ? (uint64_t)size : 0;
+    if (out != stdout && fclose(out) != 0 && res == RES_OK) {
+      gmm_set_error(error, RES_ERR, "Couldn't write %s", out_path);
+      res = RES_ERR;
+    }
+    return res;
+  }
+  int fd = out_path != NULL ? create_file(out_path, error) : STDOUT_FILENO;
+  if (fd < 0)
+    return RES_ERR;
+  RESULT res = write_json(fd, &map->chunks, opts, written, error);
+  if (out_path != NULL && close(fd) != 0 && res == RES_OK) {
+    gmm_set_error(error, RES_ERR, "Couldn't write %s", out_path);
+    res = RES_ERR;
+  }
+  return res;
+}
+
+// Writes the decoded map like write_map, through a temporary file (see
+// temp_path). This also replaces a hard link into the cache instead of
+// overwriting the entry.
+static RESULT write_output(struct LoadedMap *map, const char *out_path,
+                           const ConvertOptions *opts, GmmError *error) {
+  uint64_t start = opts->trace != NULL ? gmm_trace_now() : 0;
+  uint64_t written;
+  char temp[PATH_MAX + 32];
+  if (out_path != NULL)
+    temp_path(temp, sizeof(temp), out_path);
+  RESULT res =
+      write_map(map, out_path != NULL ? temp : NULL, opts, &written, error);
+  if (out_path != NULL)
+    res = finish_temp(temp, out_path, res, error);
+  if (res == RES_OK && opts->trace != NULL)
+    gmm_trace_stage(opts->trace, GMM_STAGE_WRITE, map->ctx.file_name, start,
+                    written);
+  return res;
+}
+
+// Bump when the output for the same input and options changes, so entries
+// of older versions aren't used
+#define CACHE_FORMAT_VERSION 2
+
+// Hash of the input file and of every option that changes the output
+static uint64_t cache_key(const RiffFile *data, const ConvertOptions *opts) {
+  Xxh64State state;
+  xxh64_init(&state, CACHE_FORMAT_VERSION);
+  xxh64_update(&state, data->data, data->length);
+  const GmmSelection *selection = opts->selection;
+  uint32 options[5] = {opts->format, opts->cells, GMM_LAYERS_ALL, 0, 0};
+  if (selection != NULL) {
+    options[2] = selection->layers;
+    options[3] = (uint32)selection->num_level_indices;
+    options[4] = (uint32)selection->num_level_names;
+  }
+  xxh64_update(&state, options, sizeof(options));
+  if (selection != NULL) {
+    xxh64_update(&state, selection->level_indices,
+                 selection->num_level_indices * sizeof(unsigned int));
+    // the terminators keep the names apart
+    for (size_t i = 0; i < selection->num_level_names; ++i)
+      xxh64_update(&state, selection->level_names[i],
+                   strlen(selection->level_names[i]) + 1);
+  }
+  return xxh64_digest(&state);
+}
+
+// Copies the file at path to fd
+static RESULT copy_file(const char *path, int fd, GmmError *error) {
+  int in = open(path, O_RDONLY);
+  if (in < 0) {
+    gmm_set_error(error, RES_ERR, "Couldn't open %s: %s", path,
+                  strerror(errno));
+    return RES_ERR;
+  }
+  char buffer[JSON_WRITER_BUFFER_SIZE];
+  RESULT res = RES_OK;
+  ssize_t len;
+  while (res == RES_OK && (len = read(in, buffer, sizeof(buffer))) != 0) {
+    if (len < 0) {
+      if (errno != EINTR) {
+        gmm_set_error(error, RES_ERR, "Couldn't read %s: %s", path,
+                      strerror(errno));
+        res = RES_ERR;
+      }
+      continue;
+    }
+    for (ssize_t done = 0; done < len && res == RES_OK;) {
+      ssize_t written = write(fd, buffer + done, (size_t)(len - done));
+      if (written < 0 && errno != EINTR) {
+        gmm_set_error(error, RES_ERR, "Couldn't write the output");
+        res = RES_ERR;
+      }
+      done += written > 0 ? written : 0;
+    }
+  }
+  close(in);
+  return res;
+}
+
+// Makes out_path a hard link to the cache entry, or copies the entry to
+// out_path or stdout
+static RESULT deliver_entry(const char *entry, const char *out_path,
+                            GmmError *error) {
+  if (out_path == NULL)
+    return copy_file(entry, STDOUT_FILENO, error);
+  char temp[PATH_MAX + 32];
+  temp_path(temp, sizeof(temp), out_path);
+  if (link(entry, temp) == 0) {
+    RESULT res = finish_temp(temp, out_path, RES_OK, error);
+    // rename does nothing if out_path is a link to the entry already
+    unlink(temp);
+    return res;
+  }
+  // e.g. the cache is on another file system
+  int fd = create_file(temp, error);
+  if (fd < 0)
+    return RES_ERR;
+  RESULT res = copy_file(entry, fd, error);
+  if (close(fd) != 0 && res == RES_OK) {
+    gmm_set_error(error, RES_ERR, "Couldn't write %s", out_path);
+    res = RES_ERR;
+  }
+  return finish_temp(temp, out_path, res, error);
+}
+
+// Takes the output of a map that was read, but not decoded yet, from the
+// cache, or converts it and adds it to the cache
+static RESULT convert_cached(struct LoadedMap *map, const char *out_path,
+                             const ConvertOptions *opts, GmmError *error) {
+  ConvertCache *cache = opts->cache;
+  GmmError *map_error = &map->session.error;
+  char entry[PATH_MAX];
+  snprintf(entry, sizeof(entry), "%s/%016llx.%s", cache->dir,
+           (unsigned long long)cache_key(&map->data, opts),
+           opts->format == FORMAT_GMMB ? "gmmb" : "json");
+  if (access(entry, F_OK) == 0) {
+    atomic_fetch_add(&cache->hits, 1);
+  } else {
+    atomic_fetch_add(&cache->misses, 1);
+    // write_output renames the complete entry into place, so other
+    // conversions never see half of it
+    RESULT res = decode_map(map, opts, true);
+    if (res == RES_OK)
+      res = write_output(map, entry, opts, map_error);
+    if (res < 0)
+      return release_map(map, error);
+  }
+  deliver_entry(entry, out_path, map_error);
+  return release_map(map, error);
+}
+
+bool convert_parse_cells(const char *name, CellEncoding *cells) {
+  if (strcmp(name, "array") == 0)
+    *cells = CELLS_ARRAY;
+  else if (strcmp(name, "base64") == 0)
+    *cells = CELLS_BASE64;
+  else if (strcmp(name, "rle") == 0)
+    *cells = CELLS_RLE;
+  else
+    return false;
+  return true;
+}
+
+bool convert_parse_format(const char *name, OutputFormat *format) {
+  if (strcmp(name, "json") == 0)
+    *format = FORMAT_JSON;
+  else if (strcmp(name, "gmmb") == 0)
+    *format = FORMAT_GMMB;
+  else
+    return false;
+  return true;
+}
+
+bool convert_parse_levels(char *list, GmmSelection *selection) {
+  size_t count = 1;
+  for (const char *c = list; *c != '\0'; ++c)
+    count += *c == ',';
+  unsigned int *indices = malloc(count * sizeof(unsigned int));
+  const char **names = malloc(count * sizeof(const char *));
+  selection->level_indices = indices;
+  selection->level_names = names;
+  if (indices == NULL || names == NULL)
+    return false;
+  char *state = NULL;
+  for (char *item = strtok_r(list, ",", &state); item != NULL;
+       item = strtok_r(NULL, ",", &state)) {
+    char *end = NULL;
+    unsigned long index = strtoul(item, &end, 10);
+    if (end != item && *end == '\0')
+      indices[selection->num_level_indices++] = (unsigned int)index;
+    else
+      names[selection->num_level_names++] = item;
+  }
+  return true;
+}
+
+unsigned int convert_parse_layers(char *list) {
+  unsigned int layers = 0;
+  char *state = NULL;
+  for (char *item = strtok_r(list, ",", &state); item != NULL;
+       item = strtok_r(NULL, ",", &state)) {
+    int l = 0;
+    while (l < GMM_LAYER_COUNT && strcmp(item, cell_layer_to_str(l)) != 0)
+      ++l;
+    if (l == GMM_LAYER_COUNT)
+      return 0;
+    layers |= GMM_LAYER_BIT(l);
+  }
+  return layers;
+}
+
+RESULT convert_cache_init(ConvertCache *cache, const char *dir,
+                          GmmError *error) {
+  cache->dir = dir;
+  atomic_init(&cache->hits, 0);
+  atomic_init(&cache->misses, 0);
+  if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+    gmm_set_error(error, RES_ERR, "Couldn't create %s: %s", dir,
+                  strerror(errno));
+    return RES_ERR;
+  }
+  return RES_OK;
+}
+
+RESULT convert_file(const char *path, const char *out_path,
+                    const ConvertOptions *opts, GmmError *error) {
+  struct LoadedMap map;
+  if (read_map(&map, path, true, opts) < 0) {
+    *error = map.session.error;
+    return error->code;
+  }
+  if (opts->cache != NULL)
+    return convert_cached(&map, out_path, opts, error);
+  if (decode_map(&map, opts, true) == RES_OK)
+    write_output(&map, out_path, opts, &map.session.error);
+  return release_map(&map, error);
+}
+
+LoadedMap *convert_load(const char *path, const ConvertOptions *opts,
+                        GmmError *error) {
+  LoadedMap *map = malloc(sizeof(LoadedMap));
+  if (map == NULL) {
+    gmm_set_error(error, RES_OUT_OF_MEMORY, "Out of memory");
+    return NULL;
+  }
+  if (read_map(map, path, false, opts) < 0) {
+    *error = map->session.error;
+    free(map);
+    return NULL;
+  }
+  // the map may outlive path and the selection
+  map->ctx.file_name = NULL;
+  // All layers are decoded up front, so a damaged one fails here and not
+  // after a client was told that the conversion succeeded
+  if (decode_map(map, opts, false) < 0) {
+    release_map(map, error);
+    free(map);
+    return NULL;
+  }
+  map->session.selection = NULL;
+  return map;
+}
+
+RESULT convert_write(LoadedMap *map, int fd, const ConvertOptions *opts,
+                     GmmError *error) {
+  GmmError *map_error = &map->session.error;
+  RESULT res;
+  if (opts->format == FORMAT_GMMB) {
+    int out_fd = dup(fd);
+    FILE *out = out_fd >= 0 ? fdopen(out_fd, "wb") : NULL;
+    if (out == NULL) {
+      if (out_fd >= 0)
+        close(out_fd);
+      gmm_set_error(map_error, RES_ERR, "Couldn't write the output");
+      res = RES_ERR;
+    } else {
+      res = write_gmmb(out, &map->chunks, &map->session);
+      if (fclose(out) != 0 && res == RES_OK) {
+        gmm_set_error(map_error, RES_ERR, "Couldn't write the output");
+        res = RES_ERR;
+      }
+    }
+  } else {
+    uint64_t written;
+    res = write_json(fd, &map->chunks, opts, &written, map_error);
+  }
+  if (res < 0)
+    *error = *map_error;
+  // the map stays usable for the next conversion
+  map_error->code = RES_OK;
+  map_error->message[0] = '\0';
+  return res;
+}
+
+void convert_free(LoadedMap *map) {
+  if (map == NULL)
+    return;
+  release_map(map, NULL);
+  free(map);
+}
+
+static bool is_level(const GmmChunk *ck) {
+  return ck->ctype == GMM_LIST &&
+         gmm_fourcc(ck->list_chunk.ckType) == GMM_FOURCC('l', 'v', 'l', ' ');
+}
+
+RESULT shard_write_level(const char *dir, unsigned int index, GmmChunk *level,
+                         const ConvertOptions *opts, ShardLevel *entry,
+                         GmmError *error) {
+  char path[PATH_MAX];
+  char temp[PATH_MAX + 32];
+  snprintf(path, sizeof(path), "%s/level_%u.json", dir, index);
+  temp_path(temp, sizeof(temp), path);
+  JsonWriter *out = malloc(sizeof(JsonWriter));
+  if (out == NULL) {
+    gmm_set_error(error, RES_OUT_OF_MEMORY, "Out of memory");
+    return RES_OUT_OF_MEMORY;
+  }
+  int fd = create_file(temp, error);
+  if (fd < 0) {
+    free(out);
+    return RES_ERR;
+  }
+  Xxh64State hash;
+  json_writer_init(out, fd);
+  xxh64_init(&hash, 0);
+  out->hash = &hash;
+  RESULT res = export_gmm(out, level, opts);
+  json_raw(out, "\n", 1);
+  if ((json_writer_flush(out) < 0 || close(fd) != 0) && res == RES_OK) {
+    gmm_set_error(error, RES_ERR, "Couldn't write %s", path);
+    res = RES_ERR;
+  }
+  res = finish_temp(temp, path, res, error);
+
+  memset(entry, 0, sizeof(ShardLevel));
+  entry->index = index;
+  entry->bytes = out->bytes_written;
+  entry->xxh64 = xxh64_digest(&hash);
+  free(out);
+  for (size_t i = 0; i < level->list_chunk.children.len; ++i) {
+    GmmChunk *child = &level->list_chunk.children.data[i];
+    if (child->ctype == GMM_LVL_PROP) {
+      entry->prop = &child->level_prop_chunk;
+      break;
+    }
+  }
+  return res;
+}
+
+// Writes the map chunks outside of levels to the manifest
+static RESULT export_map_chunks(JsonWriter *manifest, GmmChunkArray *chunks,
+                                const ConvertOptions *opts) {
+  for (size_t i = 0; i < chunks->len; ++i) {
+    GmmChunk *ck = &chunks->data[i];
+    RESULT res = RES_OK;
+    if (is_level(ck))
+      continue;
+    if (ck->ctype == GMM_LIST)
+      res = export_map_chunks(manifest, &ck->list_chunk.children, opts);
+    else if (ck->ctype == GMM_MAP_PROP || ck->ctype == GMM_MAP_COOR ||
+             ck->ctype == GMM_MAP_LINKS)
+      res = export_gmm(manifest, ck, opts);
+    if (res < 0)
+      return res;
+  }
+  return RES_OK;
+}
+
+// dir/manifest.json has the map chunks and lists the level files:
+// { "chunks": [ MAP_PROP, MAP_COOR, MAP_LINKS ], "levels": [ { "file": ...,
+//   "level_name": ..., "num_rows": ..., "bytes": ..., "xxh64": ... } ] }
+RESULT shard_write_manifest(const char *dir, GmmChunkArray *chunks,
+                            const ShardLevel *levels, size_t num_levels,
+                            const ConvertOptions *opts, GmmError *error) {
+  char path[PATH_MAX];
+  char temp[PATH_MAX + 32];
+  snprintf(path, sizeof(path), "%s/manifest.json", dir);
+  temp_path(temp, sizeof(temp), path);
+  JsonWriter *manifest = malloc(sizeof(JsonWriter));
+  if (manifest == NULL) {
+    gmm_set_error(error, RES_OUT_OF_MEMORY, "Out of memory");
+    return RES_OUT_OF_MEMORY;
+  }
+  int fd = create_file(temp, error);
+  if (fd < 0) {
+    free(manifest);
+    return RES_ERR;
+  }
+
+  json_writer_init(manifest, fd);
+  json_begin_object(manifest);
+  json_key(manifest, "chunks");
+  json_begin_array(manifest);
+  RESULT res = export_map_chunks(manifest, chunks, opts);
+  json_end_array(manifest);
+  json_key(manifest, "levels");
+  json_begin_array(manifest);
+  for (size_t i = 0; i < num_levels; ++i) {
+    const ShardLevel *level = &levels[i];
+    char name[32];
+    char digest[17];
+    snprintf(name, sizeof(name), "level_%u.json", level->index);
+    snprintf(digest, sizeof(digest), "%016llx",
+             (unsigned long long)level->xxh64);
+    json_begin_object(manifest);
+    json_key(manifest, "file");
+    json_string(manifest, name, strlen(name));
+    if (level->prop != NULL) {
+      JSOBJ_STR(manifest, *level->prop, location_name);
+      JSOBJ_STR(manifest, *level->prop, level_name);
+      JSOBJ_INT(manifest, *level->prop, elevation);
+      JSOBJ_UINT(manifest, *level->prop, num_rows);
+      JSOBJ_UINT(manifest, *level->prop, num_columns);
+    }
+    json_key(manifest, "bytes");
+    json_uint(manifest, level->bytes);
+    json_key(manifest, "xxh64");
+    json_string(manifest, digest, 16);
+    json_end_object(manifest);
+  }
+  json_end_array(manifest);
+  json_end_object(manifest);
+  json_raw(manifest, "\n", 1);
+  if ((json_writer_flush(manifest) < 0 || close(fd) != 0) && res == RES_OK) {
+    gmm_set_error(error, RES_ERR, "Couldn't write %s", path);
+    res = RES_ERR;
+  }
+  free(manifest);
+  return finish_temp(temp, path, res, error);
+}
+
+RESULT shard_collect_levels(GmmChunkArray *chunks, GmmChunkRefArray *levels) {
+  for (size_t i = 0; i < chunks->len; ++i) {
+    GmmChunk *ck = &chunks->data[i];
+    if (is_level(ck)) {
+      if (chunk_ref_array_append(levels, &ck) < 0)
+        return RES_OUT_OF_MEMORY;
+    } else if (ck->ctype == GMM_LIST &&
+               shard_collect_levels(&ck->list_chunk.children, levels) < 0) {
+      return RES_OUT_OF_MEMORY;
+    }
+  }
+  return RES_OK;
+}
+
+static RESULT write_shards(const char *dir, GmmSession *session,
+                           GmmChunkArray *chunks, const ConvertOptions *opts) {
+  GmmError *error = &session->error;
+  if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+    gmm_set_error(error, RES_ERR, "Couldn't create %s: %s", dir,
+                  strerror(errno));
+    return RES_ERR;
+  }
+  GmmChunkRefArray levels;
+  if (chunk_ref_array_init_in(&levels, &session->arena, 16) < 0 ||
+      shard_collect_levels(chunks, &levels) < 0) {
+    gmm_set_error(error, RES_OUT_OF_MEMORY, "Out of memory");
+    return RES_OUT_OF_MEMORY;
+  }
+  size_t num_levels = levels.len;
+  ShardLevel *entries =
+      arena_alloc(&session->arena, (num_levels + 1) * sizeof(ShardLevel));
+  if (entries == NULL) {
+    gmm_set_error(error, RES_OUT_OF_MEMORY, "Out of memory");
+    return RES_OUT_OF_MEMORY;
+  }
+  uint64_t start = opts->trace != NULL ? gmm_trace_now() : 0;
+  uint64_t written = 0;
+  for (size_t i = 0; i < num_levels; ++i) {
+    GmmChunk *level = levels.data[i];
+    // the files are named by the index in the map, which MAP_LINKS refer to
+    unsigned int index = level->list_chunk.level_index;
+    uint64_t level_start = opts->trace != NULL ? gmm_trace_now() : 0;
+    if (shard_write_level(dir, index, level, opts, &entries[i], error) < 0)
+      return error->code;
+    if (opts->trace != NULL)
+      gmm_trace_level(opts->trace, GMM_STAGE_WRITE, index, level_start);
+    written += entries[i].bytes;
+  }
+  RESULT res =
+      shard_write_manifest(dir, chunks, entries, num_levels, opts, error);
+  if (res == RES_OK && opts->trace != NULL)
+    gmm_trace_stage(opts->trace, GMM_STAGE_WRITE, dir, start, written);
+  return res;
+}
+
+RESULT convert_shards(const char *path, const char *dir,
+                      const ConvertOptions *opts, GmmError *error) {
+  struct LoadedMap map;
+  if (load_map(&map, path, opts) < 0) {
+    *error = map.session.error;
+    return error->code;
+  }
+  write_shards(dir, &map.session, &map.chunks, opts);
+  return release_map(&map, error);
+}
+
+#undef JSOBJ_STR
+#undef JSOBJ_UINT
+#undef JSOBJ_INT
+
+RESULT convert_stream(int in_fd, const char *name, int out_fd,
+                      const ConvertOptions *opts, GmmError *error) {
+  Context ctx = {(char *)name};
+  GmmStream *stream = gmm_stream_open(in_fd, &ctx, error);
+  if (stream == NULL)
+    return error->code;
+  JsonWriter *out = malloc(sizeof(JsonWriter));
+  if (out == NULL) {
+    gmm_set_error(error, RES_OUT_OF_MEMORY, "Out of memory");
+    gmm_stream_close(stream);
+    return RES_OUT_OF_MEMORY;
+  }
+  json_writer_init(out, out_fd);
+  json_begin_array(out);
+  RESULT res = RES_OK;
+  while (res == RES_OK) {
+    GmmStreamEvent event;
+    if (gmm_stream_next_chunk(stream, &event) < 0) {
+      *error = *gmm_stream_error(stream);
+      res = error->code;
+      break;
+    }
+    if (event.type == GMM_EVENT_END)
+      break;
+    if (event.type == GMM_EVENT_LIST_LEAVE) {
+      json_end_array(out);
+      json_end_object(out);
+      continue;
+    }
+
+    if (event.type == GMM_EVENT_LIST_ENTER) {
+      // the same as export_gmm writes for a LIST, up to its children
+      const char *ck_type = chunk_type_to_str(GMM_LIST);
+      json_begin_object(out);
+      json_key(out, "chunk_type");
+      json_string(out, ck_type, strlen(ck_type));
+      json_key(out, "list_type");
+      json_string(out, (const char *)event.chunk->list_chunk.ckType, 4);
+      json_key(out, "children");
+      json_begin_array(out);
+    } else if (export_gmm(out, event.chunk, opts) < 0) {
+      *error = *gmm_stream_error(stream);
+      res = error->code;
+    }
+  }
+  // a failed conversion leaves the output unterminated
+  if (res == RES_OK) {
+    json_end_array(out);
+    json_raw(out, "\n", 1);
+  }
+  if (json_writer_flush(out) < 0 && res == RES_OK) {
+    gmm_set_error(error, RES_ERR, "Couldn't write the output");
+    res = RES_ERR;
+  }
+  free(out);
+  gmm_stream_close(stream);
+  return res;
+}
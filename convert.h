@@ -0,0 +1,148 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stdatomic.h>
+
+#include "gmm_file.h"
+#include "json_writer.h"
+
+// Conversion of whole maps, as done by the gmm2json tool. The functions
+// don't print anything and don't exit, errors are returned and described in
+// *error. Any number of conversions can run at once on different threads.
+
+// How the layers of LVL_CELL chunks are written
+typedef enum CellEncoding {
+  CELLS_ARRAY = 0, // an array of numbers per layer
+  // { "encoding": "base64", "data": "..." } with the bytes of the cells
+  CELLS_BASE64,
+  // The layer as it is stored in the file. Uses "rle-base64" for the base64
+  // of a Gridmonger RLE stream, "base64" for uncompressed layers and "zero"
+  // for layers without data.
+  CELLS_RLE,
+} CellEncoding;
+
+typedef enum OutputFormat {
+  FORMAT_JSON = 0,
+  FORMAT_GMMB, // the flat binary format of gmmb.h
+} OutputFormat;
+
+// Directory of earlier outputs, keyed by the XXH64 of the input file and
+// the options that change the output. Can be shared by concurrent
+// conversions.
+typedef struct ConvertCache {
+  const char *dir;
+  atomic_size_t hits;   // outputs taken from the cache
+  atomic_size_t misses; // outputs converted and added to the cache
+} ConvertCache;
+
+typedef struct ConvertOptions {
+  CellEncoding cells;
+  OutputFormat format;
+  unsigned int threads;          // threads that decode the levels of a map
+  const GmmSelection *selection; // NULL converts everything
+  ConvertCache *cache;           // NULL always converts
+  GmmTrace *trace;               // NULL records no statistics, see trace.h
+  // Memory of the decoded maps, NULL uses malloc. See allocator.h.
+  const GmmAllocator *allocator;
+} ConvertOptions;
+
+// Parse the option values of the gmm2json tool. They return false (or 0)
+// for values that aren't valid.
+// "array", "base64" or "rle"
+bool convert_parse_cells(const char *name, CellEncoding *cells);
+// "json" or "gmmb"
+bool convert_parse_format(const char *name, OutputFormat *format);
+// Parses a comma separated list of level indices and names into selection.
+// The names point into list, which is modified. The arrays are malloc'd and
+// have to be freed by the caller, also if it fails.
+bool convert_parse_levels(char *list, GmmSelection *selection);
+// Parses a comma separated list of layer names into a mask of GMM_LAYER_BIT.
+// list is modified.
+unsigned int convert_parse_layers(char *list);
+
+// Creates the cache directory if it doesn't exist yet.
+RESULT convert_cache_init(ConvertCache *cache, const char *dir,
+                          GmmError *error);
+
+// Writes the chunk, and the children of LIST chunks, as a JSON object. Fails
+// if a cell layer can't be decoded, the reason is recorded in the error of
+// the LVL_CELL chunk.
+RESULT export_gmm(JsonWriter *result, GmmChunk *ck, const ConvertOptions *opts);
+
+// Converts the GMM file at path ("-" reads stdin) and writes the result to
+// out_path, or to stdout if out_path is NULL. With a cache, out_path becomes
+// a hard link to the cache entry (or a copy, if it can't be linked).
+RESULT convert_file(const char *path, const char *out_path,
+                    const ConvertOptions *opts, GmmError *error);
+// A decoded map that can be converted more than once
+typedef struct LoadedMap LoadedMap;
+
+// Reads and decodes the map at path. The file is read into memory instead
+// of being mapped, so it may change while the map is kept. Only
+// opts->selection, opts->threads and opts->trace are used. All selected cell
+// layers are decoded, so convert_write only fails on output errors. Returns
+// NULL on errors.
+LoadedMap *convert_load(const char *path, const ConvertOptions *opts,
+                        GmmError *error);
+// Writes the map to fd in the format and cell encoding of opts. Errors are
+// recorded in the map, so only one thread at a time can write a map.
+RESULT convert_write(LoadedMap *map, int fd, const ConvertOptions *opts,
+                     GmmError *error);
+void convert_free(LoadedMap *map);
+
+// Converts a GMM file that is read from in_fd chunk by chunk into JSON on
+// out_fd. Every chunk is written out as soon as it is decoded, so only one
+// chunk at a time is kept in memory. Selections and GMMB output need the
+// whole map and aren't supported. name is used in error messages.
+RESULT convert_stream(int in_fd, const char *name, int out_fd,
+                      const ConvertOptions *opts, GmmError *error);
+// Writes every level of the GMM file at path into a JSON file of its own in
+// dir, and the map chunks into dir/manifest.json, see README.md.
+RESULT convert_shards(const char *path, const char *dir,
+                      const ConvertOptions *opts, GmmError *error);
+
+// A level file of a sharded export, as it is listed in the manifest
+typedef struct ShardLevel {
+  unsigned int index; // of the level, the file is level_<index>.json
+  const RiffChunkLevelProperties *prop; // NULL if the level has none
+  uint64_t bytes;                       // size of the file
+  uint64_t xxh64;                       // hash of the file
+} ShardLevel;
+
+// The parts of convert_shards, for exports that only update some levels.
+// Writes the "lvl " LIST level to dir/level_<index>.json and describes the
+// file in *entry. entry->prop points into level.
+RESULT shard_write_level(const char *dir, unsigned int index, GmmChunk *level,
+                         const ConvertOptions *opts, ShardLevel *entry,
+                         GmmError *error);
+DYNARRAY(GmmChunkRefArray, GmmChunk *, chunk_ref_array)
+
+// Appends pointers to the "lvl " LISTs of the tree chunks to levels, in file
+// order.
+RESULT shard_collect_levels(GmmChunkArray *chunks, GmmChunkRefArray *levels);
+// Writes dir/manifest.json with the map chunks of the tree chunks (levels
+// are skipped) and the given level files.
+RESULT shard_write_manifest(const char *dir, GmmChunkArray *chunks,
+                            const ShardLevel *levels, size_t num_levels,
+                            const ConvertOptions *opts, GmmError *error);
+
+#endif // CONVERT_H
@@ -23,6 +23,4 @@ const RESULT RES_OK = 0;
 const RESULT RES_ERR = -1;
 const RESULT RES_BUFFER_TOO_SMALL = -2;
 const RESULT RES_BAD_INPUT = -3;
-
-// const char oom_message[] = "Out of memory.\n\r";
-RESULT last_error = RES_OK;
+const RESULT RES_OUT_OF_MEMORY = -4;
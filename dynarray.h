@@ -20,84 +20,104 @@
 #ifndef DYNARRAY_H
 #define DYNARRAY_H
 
-#include <memory.h>
-#include <stdlib.h>
+#include <stdint.h>
 
-typedef struct Dynarray {
-  unsigned int len;
-  unsigned int cap;
-  size_t elsize;
-  char *data; // Bytes of data
-} Dynarray;
+#include "allocator.h"
+#include "arena.h"
+#include "defs.h"
 
-static inline Dynarray make_dynarray(size_t elsize, unsigned int n) {
-  Dynarray result;
-  result.data = (char *)malloc(elsize * n);
-  result.len = 0;
-  result.cap = n;
-  result.elsize = elsize;
-  return result;
-}
-
-static inline void dynarray_free(Dynarray *arr) { free(arr->data); }
+// Typed dynamic arrays. DYNARRAY(Name, T, prefix) declares the array type
+// Name with elements of type T, and its functions prefix_init, prefix_push
+// and so on. The elements are accessed directly as data[0] to data[len - 1].
+//
+// An array either lives in an arena, then it doesn't need to be freed, or
+// takes its memory from an allocator and has to be freed with prefix_free.
 
-static inline void *dynarray_push_inplace(Dynarray *arr) {
-  unsigned int new_cap = arr->cap;
-  unsigned int new_len = arr->len + 1;
-  // determine new capacity
-  while (new_cap <= new_len)
-    new_cap <<= 1;
-  // new_cap is now > n.
-  if (new_cap != arr->cap) {
-    char *new_data = (char *)realloc(arr->data, arr->elsize * new_cap);
-    if (new_data == NULL) {
-      // Out of memory
-      // free(arr.data); We don't free memory before exit.
-      exit(EXIT_FAILURE);
-    }
-    arr->data = new_data;
-  }
-  arr->len = new_len;
-  return &arr->data[arr->elsize * (new_len - 1)];
+static inline void *_dynarray_grow(Arena *arena,
+                                   const GmmAllocator *allocator, void *data,
+                                   size_t old_size, size_t new_size) {
+  if (arena != NULL)
+    return arena_realloc(arena, data, old_size, new_size);
+  return gmm_realloc(allocator, data, old_size, new_size);
 }
 
-static inline void dynarray_set(Dynarray *arr, unsigned int n, void *d) {
-  if (n >= arr->len) {
-    unsigned int new_cap = arr->cap;
-    unsigned int new_len = n + 1;
-    // determine new capacity
-    while (new_cap <= new_len)
-      new_cap <<= 1;
-    // new_cap is now > n.
-    if (new_cap != arr->cap) {
-      char *new_data = (char *)realloc(arr->data, arr->elsize * new_cap);
-      if (new_data == NULL) {
-        // Out of memory
-        // free(arr.data); We don't free memory before exit.
-        exit(EXIT_FAILURE);
-      }
-      arr->data = new_data;
-    }
-    arr->len = new_len;
-  }
-  memcpy(arr->data + arr->elsize * n, d, arr->elsize);
-}
+// Declares only the type, for element types that aren't complete yet. The
+// functions are declared later with DYNARRAY_FUNCTIONS.
+#define DYNARRAY_TYPE(Name, T)                                                 \
+  typedef struct Name {                                                        \
+    T *data;                                                                   \
+    size_t len;                                                                \
+    size_t cap;                                                                \
+    Arena *arena; /* if not NULL, data is allocated from the arena */          \
+    const GmmAllocator *allocator; /* of data, unless it is in an arena */     \
+  } Name;
 
-static inline void *dynarray_get(Dynarray *arr, unsigned int n) {
-  if (arr->len <= n)
-    return NULL;
-  return (void *)&arr->data[arr->elsize * n];
-}
-
-static inline unsigned int dynarray_size(Dynarray *arr) { return arr->len; }
-
-static inline void dynarray_push(Dynarray *arr, void *d) {
-  dynarray_set(arr, arr->len, d);
-}
+#define DYNARRAY_FUNCTIONS(Name, T, prefix)                                    \
+  static inline void prefix##_free(Name *arr) {                                \
+    if (arr->arena == NULL)                                                    \
+      gmm_free(arr->allocator, arr->data, arr->cap * sizeof(T));               \
+    arr->data = NULL;                                                          \
+    arr->len = 0;                                                              \
+    arr->cap = 0;                                                              \
+  }                                                                            \
+                                                                               \
+  /* Makes room for at least cap elements. Returns RES_OUT_OF_MEMORY if */     \
+  /* the array can't grow. */                                                  \
+  static inline RESULT prefix##_reserve(Name *arr, size_t cap) {               \
+    if (cap <= arr->cap)                                                       \
+      return RES_OK;                                                           \
+    if (cap > SIZE_MAX / sizeof(T))                                            \
+      return RES_OUT_OF_MEMORY;                                                \
+    void *data = _dynarray_grow(arr->arena, arr->allocator, arr->data,         \
+                                arr->cap * sizeof(T), cap * sizeof(T));        \
+    if (data == NULL)                                                          \
+      return RES_OUT_OF_MEMORY;                                                \
+    arr->data = (T *)data;                                                     \
+    arr->cap = cap;                                                            \
+    return RES_OK;                                                             \
+  }                                                                            \
+                                                                               \
+  /* Takes the memory from allocator, NULL uses malloc. Room for cap */        \
+  /* elements is reserved right away. */                                       \
+  static inline RESULT prefix##_init(Name *arr, const GmmAllocator *allocator, \
+                                     size_t cap) {                             \
+    arr->data = NULL;                                                          \
+    arr->len = 0;                                                              \
+    arr->cap = 0;                                                              \
+    arr->arena = NULL;                                                         \
+    arr->allocator = allocator != NULL ? allocator : &gmm_malloc_allocator;    \
+    return prefix##_reserve(arr, cap);                                         \
+  }                                                                            \
+                                                                               \
+  static inline RESULT prefix##_init_in(Name *arr, Arena *arena, size_t cap) { \
+    arr->data = NULL;                                                          \
+    arr->len = 0;                                                              \
+    arr->cap = 0;                                                              \
+    arr->arena = arena;                                                        \
+    arr->allocator = arena->allocator;                                         \
+    return prefix##_reserve(arr, cap);                                         \
+  }                                                                            \
+                                                                               \
+  /* Appends an uninitialized element and returns it, or NULL when out of */   \
+  /* memory. Pointers to the elements are invalidated if the array grows. */   \
+  static inline T *prefix##_push(Name *arr) {                                  \
+    if (arr->len == arr->cap &&                                                \
+        prefix##_reserve(arr, arr->cap > 0 ? arr->cap * 2 : 4) < 0)            \
+      return NULL;                                                             \
+    return &arr->data[arr->len++];                                             \
+  }                                                                            \
+                                                                               \
+  /* "T const" instead of "const T" also works for pointer types T */          \
+  static inline RESULT prefix##_append(Name *arr, T const *value) {            \
+    T *slot = prefix##_push(arr);                                              \
+    if (slot == NULL)                                                          \
+      return RES_OUT_OF_MEMORY;                                                \
+    *slot = *value;                                                            \
+    return RES_OK;                                                             \
+  }
 
-static inline void dynarray_pop(Dynarray *arr) {
-  if (arr->len > 0)
-    arr->len--;
-}
+#define DYNARRAY(Name, T, prefix)                                              \
+  DYNARRAY_TYPE(Name, T)                                                       \
+  DYNARRAY_FUNCTIONS(Name, T, prefix)
 
 #endif // DYNARRAY_H
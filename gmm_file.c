@@ -18,307 +18,442 @@
    <https://www.gnu.org/licenses/>
 */
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 #include "defs.h"
 #include "gmm_file.h"
+#include "rle.h"
+#include "threadpool.h"
+#include "trace.h"
 
+// Error handling of the library. These macros don't print anything and never
+// exit. The error is recorded in a GmmError and passed up to the caller as a
+// RESULT.
+#define GMM_CHECK(error, cond, code, ...)                                      \
+  if (cond) {                                                                  \
+    gmm_set_error(error, code, __VA_ARGS__);                                   \
+    goto onerror;                                                              \
+  }
+#define GMM_PROPAGATE(error)                                                   \
+  if ((error)->code < 0)                                                       \
+    goto onpropagate;
+#define GMM_OOM(error, ptr)                                                    \
+  if ((ptr) == NULL) {                                                         \
+    gmm_set_error(error, RES_OUT_OF_MEMORY, "Out of memory");                  \
+    goto onerror;                                                              \
+  }
+
+void gmm_set_error(GmmError *error, RESULT code, const char *format, ...) {
+  // keep the first error, the following ones are usually caused by it
+  if (error == NULL || error->code < 0)
+    return;
+  error->code = code;
+  va_list args;
+  va_start(args, format);
+  vsnprintf(error->message, sizeof(error->message), format, args);
+  va_end(args);
+}
+
+// A flat range of the data that is being decoded. Nested chunks get a cursor
+// of their own that covers just their body, so advancing one never has to
+// update the cursors of the enclosing chunks.
 struct DecodingCursor {
-  const uint8 **data;
-  size_t *len;
-  struct DecodingCursor *parent;
+  const uint8 *base; // start of the file, offsets are relative to it
+  const uint8 *pos;
+  const uint8 *end;
 };
 
 struct DecodingContext {
   size_t level_size;
-  const char *list_type;
+  uint32 list_type; // FourCC of the enclosing LIST, 0 at the top level
+  Arena *arena;
+  // Arena of the session. Differs from arena on parallel decoding threads.
+  // Data that is decoded after decode_chunks returns is allocated here.
+  Arena *session_arena;
+  unsigned int flags; // GMM_DECODE_* flags of the session
+  unsigned int threads;
+  GmmHandlerArray *handlers; // registered with the session
+  GmmError *error;    // errors of this decode, per thread
+  // Error state of the session, for errors after decode_chunks returns
+  GmmError *session_error;
+  const GmmSelection *selection; // NULL decodes everything
+  GmmTrace *trace;               // NULL records no statistics
+  // Index of the first level in the decoded range, for threads that decode
+  // a single level
+  unsigned int first_level;
 };
 
-RESULT
-advance_cursor(struct DecodingCursor cursor, size_t delta) {
-  if (*cursor.len < delta)
-    return RES_ERR;
-  *cursor.data += delta;
-  *cursor.len -= delta;
-  struct DecodingCursor *par = cursor.parent;
-  while (par != NULL) {
-    *par->len -= delta;
-    par = par->parent;
-  }
-  return RES_OK;
+PACKED_STRUCT ChunkHeader {
+  char ckId[4];
+  uint32 ckSize;
+};
+
+static struct DecodingCursor make_cursor(const uint8 *data, size_t len) {
+  struct DecodingCursor result = {data, data, data + len};
+  return result;
+}
+
+static inline size_t cursor_remaining(const struct DecodingCursor *cursor) {
+  return (size_t)(cursor->end - cursor->pos);
+}
+
+static inline size_t cursor_offset(const struct DecodingCursor *cursor) {
+  return (size_t)(cursor->pos - cursor->base);
 }
 
-struct DecodingCursor recursive_cursor_from(struct DecodingCursor *cursor,
-                                            size_t *new_len) {
-  if (*new_len > *cursor->len) {
-    last_error = RES_BUFFER_TOO_SMALL;
-    struct DecodingCursor null_cursor = {NULL, NULL, NULL};
-    return null_cursor;
+// Returns the next n bytes and advances the cursor past them. If there are
+// fewer than n bytes left, records the error and returns NULL.
+static inline const void *cursor_take(struct DecodingCursor *cursor, size_t n,
+                                      GmmError *error) {
+  if (cursor_remaining(cursor) < n) {
+    gmm_set_error(error, RES_BUFFER_TOO_SMALL,
+                  "Unexpected end of a chunk at offset %zu. The file might be "
+                  "damaged.",
+                  cursor_offset(cursor));
+    return NULL;
   }
-  struct DecodingCursor result = {cursor->data, new_len, cursor};
+  const uint8 *result = cursor->pos;
+  cursor->pos += n;
   return result;
 }
 
-void free_gmmfile(RiffFile *f) { free(f->data); }
+// Splits the next n bytes off into a cursor of their own.
+static inline struct DecodingCursor
+cursor_sub(struct DecodingCursor *cursor, size_t n, GmmError *error) {
+  struct DecodingCursor result = {cursor->base, cursor->pos, cursor->pos};
+  if (cursor_take(cursor, n, error) != NULL)
+    result.end = result.pos + n;
+  return result;
+}
 
-char *decode_wstr(struct DecodingCursor cursor) {
-  char *result = NULL;
-  // We have a size prefix in front
-  uint16 *str_len = (uint16 *)*cursor.data;
-  advance_cursor(cursor, 2);
-  PROPAGATEERR();
+// Advances the cursor past the next chunk and its alignment byte.
+static RESULT skip_chunk(struct DecodingCursor *cursor) {
+  const struct ChunkHeader *header =
+      cursor_take(cursor, sizeof(struct ChunkHeader), NULL);
+  if (header == NULL || header->ckSize > cursor_remaining(cursor))
+    return RES_BAD_INPUT;
+  cursor->pos += header->ckSize;
+  // The last chunk of the file may come without its alignment byte
+  if (header->ckSize % 2 == 1 && cursor->pos < cursor->end)
+    cursor->pos += 1;
+  return RES_OK;
+}
 
-  if (*str_len > *cursor.len) {
-    // size prefix indicates size that is more than the data stream
-    last_error = RES_BUFFER_TOO_SMALL;
-    goto onpropagate;
+// Counts the chunks in cursor by their header sizes, so arrays for them are
+// allocated once. Stops at a damaged chunk, decoding reports that one.
+static size_t count_chunks(struct DecodingCursor cursor) {
+  size_t count = 0;
+  while (cursor_remaining(&cursor) > 0 && skip_chunk(&cursor) == RES_OK)
+    ++count;
+  return count;
+}
+
+void free_gmmfile(RiffFile *f) {
+#ifndef _WIN32
+  if (f->mapping) {
+    munmap(f->mapping, f->mapping_len);
+    f->mapping = NULL;
+    f->data = NULL;
+    return;
   }
+#endif
+  gmm_free(f->allocator, (void *)f->data, f->length);
+  f->data = NULL;
+}
 
-  result = malloc(*str_len + 1);
-  memset(result, 0, *str_len + 1);
-  OOMERROR(result);
-  strncpy(result, (char *)*cursor.data, *str_len);
-  advance_cursor(cursor, *str_len);
-  PROPAGATEERR();
+// Decodes the str_len bytes of string data at the cursor. Depending on the
+// session flags the result is a view into the source buffer or a NUL
+// terminated copy in the arena. On error str is NULL.
+static GmmString decode_str_data(struct DecodingCursor *cursor, size_t str_len,
+                                 const struct DecodingContext *ctx) {
+  GmmString result = {NULL, 0};
+  // fails if the size prefix is bigger than the rest of the chunk
+  const char *src = cursor_take(cursor, str_len, ctx->error);
+  if (src == NULL)
+    return result;
+
+  // Strings end at the first NUL byte, if there is any
+  size_t len = strnlen(src, str_len);
+  if (ctx->trace != NULL)
+    gmm_trace_string(ctx->trace, len);
+  if (ctx->flags & GMM_DECODE_STRING_VIEWS) {
+    result.str = src;
+  } else {
+    char *copy = arena_alloc(ctx->arena, len + 1);
+    GMM_OOM(ctx->error, copy);
+    memcpy(copy, src, len);
+    copy[len] = '\0';
+    result.str = copy;
+  }
+  result.len = len;
+onerror:
   return result;
-onpropagate:
-  if (result)
-    free(result);
-  return NULL;
-onoom:
-  exit(EXIT_FAILURE);
 }
 
-char *decode_bstr(struct DecodingCursor cursor) {
+GmmString decode_wstr(struct DecodingCursor *cursor,
+                      const struct DecodingContext *ctx) {
+  GmmString result = {NULL, 0};
   // We have a size prefix in front
-  char *result = NULL;
-  uint8 *str_len = (uint8 *)*cursor.data;
-  advance_cursor(cursor, 1);
-  PROPAGATEERR();
-
-  if (*str_len > *cursor.len) {
-    // size prefix indicates size that is more than the data stream
-    last_error = RES_BUFFER_TOO_SMALL;
-    return NULL;
-  }
-
-  result = malloc(*str_len + 1);
-  memset(result, 0, *str_len + 1);
-  OOMERROR(result);
-  strncpy(result, (char *)*cursor.data, *str_len);
-  advance_cursor(cursor, *str_len);
-  PROPAGATEERR();
+  const uint16 *str_len = cursor_take(cursor, sizeof(uint16), ctx->error);
+  GMM_PROPAGATE(ctx->error);
+  return decode_str_data(cursor, *str_len, ctx);
+onpropagate:
   return result;
+}
+
+GmmString decode_bstr(struct DecodingCursor *cursor,
+                      const struct DecodingContext *ctx) {
+  GmmString result = {NULL, 0};
+  // We have a size prefix in front
+  const uint8 *str_len = cursor_take(cursor, sizeof(uint8), ctx->error);
+  GMM_PROPAGATE(ctx->error);
+  return decode_str_data(cursor, *str_len, ctx);
 onpropagate:
-  if (result)
-    free(result);
-  return NULL;
-onoom:
-  exit(EXIT_FAILURE);
+  return result;
 }
 
-uint8 *decode_cell_layer(struct DecodingCursor cursor, size_t size) {
+uint8 *decode_cell_layer(struct DecodingCursor *cursor, size_t size,
+                         Arena *arena, GmmError *error) {
   // See if we have compression
   uint8 *result = NULL;
-  const uint8 *compression_type = *cursor.data;
-  advance_cursor(cursor, 1);
-  PROPAGATEERR();
-  result = malloc(size * sizeof(uint8));
-  OOMERROR(result);
-  if (*compression_type == 0) {
+  const uint8 *compression_type = cursor_take(cursor, 1, error);
+  GMM_PROPAGATE(error);
+  result = arena_alloc(arena, size * sizeof(uint8));
+  GMM_OOM(error, result);
+  if (*compression_type == GMM_CELLS_RAW) {
     // No compression, just memcpy.
-    const uint8 *src_data = *cursor.data;
-    advance_cursor(cursor, size);
-    PROPAGATEERR();
+    const uint8 *src_data = cursor_take(cursor, size, error);
+    GMM_PROPAGATE(error);
     memcpy(result, src_data, size);
-  } else if (*compression_type == 1) {
-    const uint32 *compressed_length = (const uint32 *)*cursor.data;
-    advance_cursor(cursor, sizeof(uint32));
-    PROPAGATEERR();
+  } else if (*compression_type == GMM_CELLS_RLE) {
+    const uint32 *compressed_length =
+        cursor_take(cursor, sizeof(uint32), error);
+    GMM_PROPAGATE(error);
+    const uint8 *compressed_data =
+        cursor_take(cursor, *compressed_length, error);
+    GMM_PROPAGATE(error);
 
-    memset(result, 0, size);
-    const uint8 *compressed_data = *cursor.data;
-    const uint8 *compressed_end = compressed_data + *compressed_length;
-    advance_cursor(cursor, *compressed_length);
-    PROPAGATEERR();
-
-    uint8 *dest = result;
-    while (compressed_data < compressed_end) {
-      uint8 next_byte = *compressed_data;
-      if (next_byte & 0x80) {
-        compressed_data += 1;
-        uint8 repeat_len = (next_byte & (0x7f)) + 1;
-
-        // buffer overflow check
-        CHECKERR(dest + repeat_len > result + size,
-                 "Possible buffer overflow in decode_cell_layer, line %d. "
-                 "Aborting...\n",
-                 __LINE__);
-        CHECKERR(compressed_data == compressed_end,
-                 "compressed_data unexpectedly run out on line %d\n", __LINE__);
-        memset(dest, *compressed_data, repeat_len);
-
-        dest += repeat_len;
-        compressed_data += 1;
-      } else {
-        CHECKERR(dest + 1 > result + size,
-                 "Possible buffer overflow in decode_cell_layer, line %d. "
-                 "Aborting...\n",
-                 __LINE__);
-        CHECKERR(compressed_data == compressed_end,
-                 "compressed_data unexpectedly run out on line %d\n", __LINE__);
-        *dest = *compressed_data;
-        dest += 1;
-        compressed_data += 1;
-      }
-    }
-  } else if (*compression_type == 2) {
+    RESULT res = rle_decode(result, size, compressed_data, *compressed_length);
+    GMM_CHECK(error, res == RES_BUFFER_TOO_SMALL, res,
+              "Cell layer decodes to more than %zu cells.", size);
+    GMM_CHECK(error, res == RES_BAD_INPUT, res,
+              "Compressed cell layer data ends in the middle of a run.");
+  } else if (*compression_type == GMM_CELLS_ZERO) {
     memset(result, 0, size);
   } else {
-    // Unexpected value of compression_type
-    last_error = RES_BAD_INPUT;
-    goto onerror;
+    GMM_CHECK(error, true, RES_BAD_INPUT,
+              "Unexpected cell layer compression type %u.",
+              *compression_type);
   }
 
   return result;
 
 onpropagate:
 onerror:
-  if (result)
-    free(result);
   return NULL;
-onoom:
-  exit(EXIT_FAILURE);
-}
-
-size_t decode_map_prop_chunk(struct DecodingCursor cursor,
-                             RiffChunkMapProperties *out) {
-  size_t start_len = *cursor.len;
-  out->version = *(uint16 *)*cursor.data;
-  advance_cursor(cursor, 2);
-  PROPAGATEERR();
-  CHECKERR((out->title = decode_wstr(cursor)) == NULL,
-           "Error decoding WSTR map_prop.title");
-  CHECKERR((out->game = decode_wstr(cursor)) == NULL,
-           "Error decoding WSTR map_prop.game");
-  CHECKERR((out->author = decode_wstr(cursor)) == NULL,
-           "Error decoding WSTR map_prop.author");
-  CHECKERR((out->creation_time = decode_bstr(cursor)) == NULL,
-           "Error decoding BSTR map_prop.creation_time");
-  CHECKERR((out->notes = decode_wstr(cursor)) == NULL,
-           "Error decoding WSTR map_prop.notes");
-  return start_len - *cursor.len;
+}
+
+RESULT decode_map_prop_chunk(struct DecodingCursor *cursor,
+                             RiffChunkMapProperties *out,
+                             const struct DecodingContext *ctx) {
+  const uint16 *version = cursor_take(cursor, sizeof(uint16), ctx->error);
+  GMM_PROPAGATE(ctx->error);
+  out->version = *version;
+  out->title = decode_wstr(cursor, ctx);
+  GMM_PROPAGATE(ctx->error);
+  out->game = decode_wstr(cursor, ctx);
+  GMM_PROPAGATE(ctx->error);
+  out->author = decode_wstr(cursor, ctx);
+  GMM_PROPAGATE(ctx->error);
+  out->creation_time = decode_bstr(cursor, ctx);
+  GMM_PROPAGATE(ctx->error);
+  out->notes = decode_wstr(cursor, ctx);
+  GMM_PROPAGATE(ctx->error);
+  return RES_OK;
 onpropagate:
-onerror:
-  exit(EXIT_FAILURE);
+  return ctx->error->code;
 }
 
-size_t decode_map_coor_chunk(struct DecodingCursor cursor,
-                             RiffChunkMapCoords *out) {
-  PACKED_STRUCT DecodedData {
+RESULT decode_map_coor_chunk(struct DecodingCursor *cursor,
+                             RiffChunkMapCoords *out,
+                             const struct DecodingContext *ctx) {
+  const PACKED_STRUCT DecodedData {
     uint8 origin;
     uint8 row_style;
     uint8 column_style;
     uint16 row_start;
     uint16 column_start;
   }
-  *decoded_data = (struct DecodedData *)*cursor.data;
-  advance_cursor(cursor, sizeof(struct DecodedData));
-  PROPAGATEERR();
+  *decoded_data = cursor_take(cursor, sizeof(struct DecodedData), ctx->error);
+  GMM_PROPAGATE(ctx->error);
   out->origin = decoded_data->origin;
   out->row_style = decoded_data->row_style;
   out->column_style = decoded_data->column_style;
   out->row_start = decoded_data->row_start;
   out->column_start = decoded_data->column_start;
-  return sizeof(struct DecodedData);
+  return RES_OK;
 onpropagate:
-  exit(EXIT_FAILURE);
+  return ctx->error->code;
 }
 
-size_t decode_lvl_prop_chunk(struct DecodingCursor cursor,
-                             RiffChunkLevelProperties *out) {
-  size_t start_len = *cursor.len;
-  out->location_name = decode_wstr(cursor);
-  PROPAGATEERR();
-  out->level_name = decode_wstr(cursor);
-  PROPAGATEERR();
-  PACKED_STRUCT DecodedData {
+RESULT decode_lvl_prop_chunk(struct DecodingCursor *cursor,
+                             RiffChunkLevelProperties *out,
+                             const struct DecodingContext *ctx) {
+  out->location_name = decode_wstr(cursor, ctx);
+  GMM_PROPAGATE(ctx->error);
+  out->level_name = decode_wstr(cursor, ctx);
+  GMM_PROPAGATE(ctx->error);
+  const PACKED_STRUCT DecodedData {
     int16 elevation;
     uint16 num_rows;
     uint16 num_columns;
     uint8 override_coord_opts;
   }
-  *decoded_data = (struct DecodedData *)*cursor.data;
-  advance_cursor(cursor, sizeof(struct DecodedData));
-  PROPAGATEERR();
+  *decoded_data = cursor_take(cursor, sizeof(struct DecodedData), ctx->error);
+  GMM_PROPAGATE(ctx->error);
   out->elevation = decoded_data->elevation;
   out->num_rows = decoded_data->num_rows;
   out->num_columns = decoded_data->num_columns;
   out->override_coord_opts = decoded_data->override_coord_opts;
-  out->notes = decode_wstr(cursor);
-  PROPAGATEERR();
-  return start_len - *cursor.len;
+  out->notes = decode_wstr(cursor, ctx);
+  GMM_PROPAGATE(ctx->error);
+  return RES_OK;
 onpropagate:
-  exit(EXIT_FAILURE);
+  return ctx->error->code;
 }
 
-size_t decode_lvl_coor_chunk(struct DecodingCursor cursor,
-                             RiffChunkLevelCoords *out) {
-  PACKED_STRUCT DecodedData {
+RESULT decode_lvl_coor_chunk(struct DecodingCursor *cursor,
+                             RiffChunkLevelCoords *out,
+                             const struct DecodingContext *ctx) {
+  const PACKED_STRUCT DecodedData {
     uint8 origin;
     uint8 row_style;
     uint8 column_style;
     uint16 row_start;
     uint16 column_start;
   }
-  *decoded_data = (struct DecodedData *)*cursor.data;
-  advance_cursor(cursor, sizeof(struct DecodedData));
-  PROPAGATEERR();
+  *decoded_data = cursor_take(cursor, sizeof(struct DecodedData), ctx->error);
+  GMM_PROPAGATE(ctx->error);
   out->origin = decoded_data->origin;
   out->row_style = decoded_data->row_style;
   out->column_style = decoded_data->column_style;
   out->row_start = decoded_data->row_start;
   out->column_start = decoded_data->column_start;
-  return sizeof(struct DecodedData);
+  return RES_OK;
+onpropagate:
+  return ctx->error->code;
+}
+
+// Advances the cursor past the cell layer at the cursor.
+RESULT skip_cell_layer(struct DecodingCursor *cursor, size_t size,
+                       GmmError *error) {
+  const uint8 *compression_type = cursor_take(cursor, 1, error);
+  GMM_PROPAGATE(error);
+  if (*compression_type == GMM_CELLS_RAW) {
+    cursor_take(cursor, size, error);
+    GMM_PROPAGATE(error);
+  } else if (*compression_type == GMM_CELLS_RLE) {
+    const uint32 *compressed_length =
+        cursor_take(cursor, sizeof(uint32), error);
+    GMM_PROPAGATE(error);
+    cursor_take(cursor, *compressed_length, error);
+    GMM_PROPAGATE(error);
+  } else if (*compression_type != GMM_CELLS_ZERO) {
+    GMM_CHECK(error, true, RES_BAD_INPUT,
+              "Unexpected cell layer compression type %u.",
+              *compression_type);
+  }
+  return RES_OK;
 onpropagate:
-  exit(EXIT_FAILURE);
-}
-
-size_t decode_lvl_cell_chunk(struct DecodingCursor cursor,
-                             RiffChunkLevelCell *out, size_t cell_count) {
-  const uint8 *start_addr = *cursor.data;
-  out->floor = decode_cell_layer(cursor, cell_count);
-  PROPAGATEERR();
-  out->floor_orientation = decode_cell_layer(cursor, cell_count);
-  PROPAGATEERR();
-  out->floor_color = decode_cell_layer(cursor, cell_count);
-  PROPAGATEERR();
-  out->wall_north = decode_cell_layer(cursor, cell_count);
-  PROPAGATEERR();
-  out->wall_west = decode_cell_layer(cursor, cell_count);
-  PROPAGATEERR();
-  out->trail = decode_cell_layer(cursor, cell_count);
-  PROPAGATEERR();
+onerror:
+  return error->code;
+}
+
+RESULT decode_lvl_cell_chunk(struct DecodingCursor *cursor,
+                             RiffChunkLevelCell *out,
+                             const struct DecodingContext *ctx) {
+  size_t cell_count = ctx->level_size;
   out->cells_count = cell_count;
+  out->arena = ctx->session_arena;
+  out->error = ctx->session_error;
+  out->layer_mask =
+      ctx->selection != NULL ? ctx->selection->layers : GMM_LAYERS_ALL;
 
-  return *cursor.data - start_addr;
+  for (int i = 0; i < GMM_LAYER_COUNT; ++i) {
+    out->layer_data[i] = cursor->pos;
+    // unselected layers are skipped by their compressed length
+    if ((ctx->flags & GMM_DECODE_LAZY_CELLS) ||
+        !(out->layer_mask & GMM_LAYER_BIT(i))) {
+      out->layers[i] = NULL;
+      skip_cell_layer(cursor, cell_count, ctx->error);
+    } else {
+      out->layers[i] =
+          decode_cell_layer(cursor, cell_count, ctx->arena, ctx->error);
+    }
+    GMM_PROPAGATE(ctx->error);
+    out->layer_size[i] = cursor->pos - out->layer_data[i];
+    if (ctx->trace != NULL)
+      gmm_trace_layer(ctx->trace, out->layer_data[i][0], out->layer_size[i],
+                      cell_count);
+  }
+  return RES_OK;
 
 onpropagate:
-  exit(EXIT_FAILURE);
+  return ctx->error->code;
 }
 
-size_t decode_lvl_anno_chunk(struct DecodingCursor cursor,
-                             RiffChunkLevelAnno *out) {
-  const uint8 *start_addr = *cursor.data;
-  const uint16 *num_annos = (const uint16 *)*cursor.data;
-  advance_cursor(cursor, sizeof(uint16));
-  PROPAGATEERR();
+const uint8 *gmm_cell_layer(RiffChunkLevelCell *cell, GmmCellLayer layer) {
+  if (cell->layers[layer] == NULL) {
+    struct DecodingCursor cursor =
+        make_cursor(cell->layer_data[layer], cell->layer_size[layer]);
+    cell->layers[layer] = decode_cell_layer(&cursor, cell->cells_count,
+                                            cell->arena, cell->error);
+  }
+  return cell->layers[layer];
+}
+
+RESULT gmm_cell_layer_stored(const RiffChunkLevelCell *cell,
+                             GmmCellLayer layer, GmmStoredLayer *out) {
+  // the layer was bounds checked when the chunk was decoded
+  const uint8 *data = cell->layer_data[layer];
+  out->compression = data[0];
+  switch (out->compression) {
+  case GMM_CELLS_RAW:
+    out->data = data + 1;
+    out->len = cell->cells_count;
+    return RES_OK;
+  case GMM_CELLS_RLE:
+    out->data = data + 1 + sizeof(uint32);
+    out->len = cell->layer_size[layer] - 1 - sizeof(uint32);
+    return RES_OK;
+  case GMM_CELLS_ZERO:
+    out->data = NULL;
+    out->len = 0;
+    return RES_OK;
+  default:
+    return RES_BAD_INPUT;
+  }
+}
+
+RESULT decode_lvl_anno_chunk(struct DecodingCursor *cursor,
+                             RiffChunkLevelAnno *out,
+                             const struct DecodingContext *ctx) {
+  const uint16 *num_annos = cursor_take(cursor, sizeof(uint16), ctx->error);
+  GMM_PROPAGATE(ctx->error);
 
   out->num_annotations = *num_annos;
-  out->records = malloc(sizeof(AnnotationRecord) * (*num_annos));
-  OOMERROR(out->records);
+  out->records =
+      arena_alloc(ctx->arena, sizeof(AnnotationRecord) * (*num_annos));
+  GMM_OOM(ctx->error, out->records);
 
   for (uint16 i = 0; i < *num_annos; ++i) {
     const PACKED_STRUCT DecodedData {
@@ -326,51 +461,53 @@ size_t decode_lvl_anno_chunk(struct DecodingCursor cursor,
       uint16 column;
       uint8 kind;
     }
-    *decoded_data = (const struct DecodedData *)*cursor.data;
-    advance_cursor(cursor, sizeof(struct DecodedData));
-    PROPAGATEERR();
-    out->records[i].row = decoded_data->row;
-    out->records[i].column = decoded_data->column;
-    out->records[i].kind = decoded_data->kind;
+    *decoded_data =
+        cursor_take(cursor, sizeof(struct DecodedData), ctx->error);
+    GMM_PROPAGATE(ctx->error);
+    AnnotationRecord *record = &out->records[i];
+    record->row = decoded_data->row;
+    record->column = decoded_data->column;
+    record->kind = decoded_data->kind;
 
     if (decoded_data->kind == AK_INDEXED) {
       // Indexed Annotation
-      out->records[i].indexed.index = *(const uint16 *)*cursor.data;
-      advance_cursor(cursor, 2);
-      PROPAGATEERR();
-      out->records[i].indexed.index_color = **cursor.data;
-      advance_cursor(cursor, 1);
-      PROPAGATEERR();
+      const PACKED_STRUCT IndexedData {
+        uint16 index;
+        uint8 index_color;
+      }
+      *indexed = cursor_take(cursor, sizeof(struct IndexedData), ctx->error);
+      GMM_PROPAGATE(ctx->error);
+      record->indexed.index = indexed->index;
+      record->indexed.index_color = indexed->index_color;
     } else if (decoded_data->kind == AK_CUSTOM) {
       // custom id annotation
-      out->records[i].custom.custom_id = decode_bstr(cursor);
-      PROPAGATEERR();
+      record->custom.custom_id = decode_bstr(cursor, ctx);
+      GMM_PROPAGATE(ctx->error);
     } else if (decoded_data->kind == AK_ICON) {
       // icon annotation
-      out->records[i].icon.icon = **cursor.data;
-      advance_cursor(cursor, 1);
-      PROPAGATEERR();
+      const uint8 *icon = cursor_take(cursor, 1, ctx->error);
+      GMM_PROPAGATE(ctx->error);
+      record->icon.icon = *icon;
     } else if (decoded_data->kind == AK_LABEL) {
       // label annotation
-      out->records[i].label.label_color = **cursor.data;
-      advance_cursor(cursor, 1);
-      PROPAGATEERR();
+      const uint8 *label_color = cursor_take(cursor, 1, ctx->error);
+      GMM_PROPAGATE(ctx->error);
+      record->label.label_color = *label_color;
     }
 
-    out->records[i].text = decode_wstr(cursor);
-    PROPAGATEERR();
+    record->text = decode_wstr(cursor, ctx);
+    GMM_PROPAGATE(ctx->error);
   }
-
-  return *cursor.data - start_addr;
+  return RES_OK;
 
 onpropagate:
-onoom:
-  exit(EXIT_FAILURE);
+onerror:
+  return ctx->error->code;
 }
 
-size_t decode_lvl_regn_chunk(struct DecodingCursor cursor,
-                             RiffChunkLevelRegn *out) {
-  const uint8 *start_addr = *cursor.data;
+RESULT decode_lvl_regn_chunk(struct DecodingCursor *cursor,
+                             RiffChunkLevelRegn *out,
+                             const struct DecodingContext *ctx) {
   const PACKED_STRUCT DecodedData {
     uint8 enable_regions;
     uint16 row_per_region;
@@ -378,277 +515,890 @@ size_t decode_lvl_regn_chunk(struct DecodingCursor cursor,
     uint8 per_region_coords;
     uint16 num_regions;
   }
-  *decoded_data = (const struct DecodedData *)*cursor.data;
-  advance_cursor(cursor, sizeof(struct DecodedData));
-  PROPAGATEERR();
+  *decoded_data = cursor_take(cursor, sizeof(struct DecodedData), ctx->error);
+  GMM_PROPAGATE(ctx->error);
 
   out->enable_regions = decoded_data->enable_regions;
   out->rows_per_region = decoded_data->row_per_region;
   out->columns_per_region = decoded_data->columns_per_region;
   out->per_region_coords = decoded_data->per_region_coords;
   out->num_regions = decoded_data->num_regions;
-  out->records = malloc(sizeof(LevelRegionRecord) * out->num_regions);
-  OOMERROR(out->records);
+  out->records =
+      arena_alloc(ctx->arena, sizeof(LevelRegionRecord) * out->num_regions);
+  GMM_OOM(ctx->error, out->records);
 
   // printf("Decoding regions: %u regions total\n", out->num_regions);
 
   for (uint16 i = 0; i < decoded_data->num_regions; ++i) {
-    out->records[i].name = decode_wstr(cursor);
-    PROPAGATEERR();
-    out->records[i].notes = decode_wstr(cursor);
-    PROPAGATEERR();
+    out->records[i].name = decode_wstr(cursor, ctx);
+    GMM_PROPAGATE(ctx->error);
+    out->records[i].notes = decode_wstr(cursor, ctx);
+    GMM_PROPAGATE(ctx->error);
     // printf("Decoded region %u with name: '%s' with notes: '%s'\n", i,
     //       out->records[i].name, out->records[i].notes);
   }
+  return RES_OK;
 
-  return *cursor.data - start_addr;
 onpropagate:
-onoom:
-  exit(EXIT_FAILURE);
+onerror:
+  return ctx->error->code;
 }
 
-size_t decode_map_links_chunk(const struct DecodingCursor cursor,
-                              RiffChunkMapLinks *out) {
-  const uint8 *start_addr = *cursor.data;
-  const uint16 *num_links = (const uint16 *)*cursor.data;
-  advance_cursor(cursor, 2);
-  PROPAGATEERR();
+RESULT decode_map_links_chunk(struct DecodingCursor *cursor,
+                              RiffChunkMapLinks *out,
+                              const struct DecodingContext *ctx) {
+  const uint16 *num_links = cursor_take(cursor, sizeof(uint16), ctx->error);
+  GMM_PROPAGATE(ctx->error);
   out->num_links = *num_links;
-  out->records = malloc(sizeof(MapLinksRecord) * (*num_links));
-  OOMERROR(out->records);
+  out->records = arena_alloc(ctx->arena, sizeof(MapLinksRecord) * (*num_links));
+  GMM_OOM(ctx->error, out->records);
 
-  for (uint16 i = 0; i < *num_links; ++i) {
+  const PACKED_STRUCT DecodedData {
+    uint16 src_level_index;
+    uint16 src_row;
+    uint16 src_column;
+    uint16 dest_level_index;
+    uint16 dest_row;
+    uint16 dest_column;
+  }
+  *decoded_data = cursor_take(
+      cursor, sizeof(struct DecodedData) * (size_t)*num_links, ctx->error);
+  GMM_PROPAGATE(ctx->error);
 
-    const PACKED_STRUCT DecodedData {
-      uint16 src_level_index;
-      uint16 src_row;
-      uint16 src_column;
-      uint16 dest_level_index;
-      uint16 dest_row;
-      uint16 dest_column;
+  // All records have the same size, so they were bounds checked at once
+  for (uint16 i = 0; i < out->num_links; ++i) {
+    out->records[i].src_level_index = decoded_data[i].src_level_index;
+    out->records[i].src_row = decoded_data[i].src_row;
+    out->records[i].src_column = decoded_data[i].src_column;
+    out->records[i].dest_level_index = decoded_data[i].dest_level_index;
+    out->records[i].dest_row = decoded_data[i].dest_row;
+    out->records[i].dest_column = decoded_data[i].dest_column;
+  }
+  return RES_OK;
+
+onpropagate:
+onerror:
+  return ctx->error->code;
+}
+
+// Chunk registry.
+// Every chunk is dispatched on its (list type, ckId) pair of FourCCs. The
+// built-in decoders are found with a switch over the integer ckId, handlers
+// registered with gmm_session_register_handler take precedence over them.
+// Decoders get a cursor that covers exactly the body of their chunk.
+typedef RESULT (*ChunkDecoder)(struct DecodingCursor *dc, GmmChunk *out,
+                               struct DecodingContext *ctx);
+
+static RESULT decode_map_prop(struct DecodingCursor *dc, GmmChunk *out,
+                              struct DecodingContext *ctx) {
+  out->ctype = GMM_MAP_PROP;
+  return decode_map_prop_chunk(dc, &out->map_prop_chunk, ctx);
+}
+
+static RESULT decode_lvl_prop(struct DecodingCursor *dc, GmmChunk *out,
+                              struct DecodingContext *ctx) {
+  out->ctype = GMM_LVL_PROP;
+  RESULT res = decode_lvl_prop_chunk(dc, &out->level_prop_chunk, ctx);
+  // the following cell chunk needs the size of the level
+  ctx->level_size = ((size_t)out->level_prop_chunk.num_columns + 1) *
+                    ((size_t)out->level_prop_chunk.num_rows + 1);
+  return res;
+}
+
+static RESULT decode_map_coor(struct DecodingCursor *dc, GmmChunk *out,
+                              struct DecodingContext *ctx) {
+  out->ctype = GMM_MAP_COOR;
+  return decode_map_coor_chunk(dc, &out->map_coor_chunk, ctx);
+}
+
+static RESULT decode_lvl_coor(struct DecodingCursor *dc, GmmChunk *out,
+                              struct DecodingContext *ctx) {
+  out->ctype = GMM_LVL_COOR;
+  return decode_lvl_coor_chunk(dc, &out->level_coor_chunk, ctx);
+}
+
+static RESULT decode_lvl_cell(struct DecodingCursor *dc, GmmChunk *out,
+                              struct DecodingContext *ctx) {
+  out->ctype = GMM_LVL_CELL;
+  return decode_lvl_cell_chunk(dc, &out->level_cell_chunk, ctx);
+}
+
+static RESULT decode_lvl_anno(struct DecodingCursor *dc, GmmChunk *out,
+                              struct DecodingContext *ctx) {
+  out->ctype = GMM_LVL_ANNO;
+  return decode_lvl_anno_chunk(dc, &out->level_anno_chunk, ctx);
+}
+
+static RESULT decode_lvl_regn(struct DecodingCursor *dc, GmmChunk *out,
+                              struct DecodingContext *ctx) {
+  out->ctype = GMM_LVL_REGN;
+  return decode_lvl_regn_chunk(dc, &out->level_regn_chunk, ctx);
+}
+
+static RESULT decode_map_links(struct DecodingCursor *dc, GmmChunk *out,
+                               struct DecodingContext *ctx) {
+  out->ctype = GMM_MAP_LINKS;
+  return decode_map_links_chunk(dc, &out->map_links_chunk, ctx);
+}
+
+// Chunks that only store Gridmonger's internal state. They are skipped
+// without decoding and stay GMM_UNKNOWN.
+static RESULT skip_ignored_chunk(struct DecodingCursor *dc, GmmChunk *out,
+                                 struct DecodingContext *ctx) {
+  (void)out;
+  (void)ctx;
+  dc->pos = dc->end;
+  return RES_OK;
+}
+
+static ChunkDecoder builtin_decoder(uint32 list_type, uint32 ck_id) {
+  const uint32 map_list = GMM_FOURCC('m', 'a', 'p', ' ');
+  const uint32 lvl_list = GMM_FOURCC('l', 'v', 'l', ' ');
+
+  switch (ck_id) {
+  case GMM_FOURCC('p', 'r', 'o', 'p'):
+    // this is either map prop chunk or lvl prop chunk depending on context
+    if (list_type == map_list)
+      return decode_map_prop;
+    if (list_type == lvl_list)
+      return decode_lvl_prop;
+    return NULL;
+  case GMM_FOURCC('c', 'o', 'o', 'r'):
+    if (list_type == map_list)
+      return decode_map_coor;
+    if (list_type == lvl_list)
+      return decode_lvl_coor;
+    return NULL;
+  case GMM_FOURCC('c', 'e', 'l', 'l'):
+    return decode_lvl_cell;
+  case GMM_FOURCC('a', 'n', 'n', 'o'):
+    return decode_lvl_anno;
+  case GMM_FOURCC('r', 'e', 'g', 'n'):
+    return decode_lvl_regn;
+  case GMM_FOURCC('l', 'n', 'k', 's'):
+    return decode_map_links;
+  case GMM_FOURCC('d', 'i', 's', 'p'):
+  case GMM_FOURCC('o', 'p', 't', 's'):
+  case GMM_FOURCC('t', 'o', 'o', 'l'):
+  case GMM_FOURCC('n', 'o', 't', 'l'):
+    return skip_ignored_chunk;
+  default:
+    return NULL;
+  }
+}
+
+static const GmmHandlerEntry *
+find_user_handler(const struct DecodingContext *ctx, uint32 ck_id) {
+  if (ctx->handlers == NULL)
+    return NULL;
+  for (size_t i = 0; i < ctx->handlers->len; ++i) {
+    const GmmHandlerEntry *entry = &ctx->handlers->data[i];
+    if (entry->ck_id == ck_id && (entry->list_type == GMM_FOURCC_ANY ||
+                                  entry->list_type == ctx->list_type))
+      return entry;
+  }
+  return NULL;
+}
+
+static RESULT decode_user_chunk(struct DecodingCursor *dc, GmmChunk *out,
+                                struct DecodingContext *ctx,
+                                const GmmHandlerEntry *entry) {
+  out->ctype = GMM_CUSTOM;
+  out->custom_chunk.list_type = ctx->list_type;
+  out->custom_chunk.data = NULL;
+  RESULT res = entry->handler(dc->pos, cursor_remaining(dc), &out->custom_chunk,
+                              ctx->arena, entry->user_data);
+  GMM_CHECK(ctx->error, res < 0, res,
+            "Handler for chunk %.4s failed with error %d.",
+            out->custom_chunk.head.ckId, res);
+  dc->pos = dc->end;
+  return RES_OK;
+onerror:
+  return ctx->error->code;
+}
+
+// True for chunks that are skipped without looking at their body.
+static bool is_ignored_chunk(const struct DecodingContext *ctx, uint32 ck_id) {
+  return find_user_handler(ctx, ck_id) == NULL &&
+         builtin_decoder(ctx->list_type, ck_id) == skip_ignored_chunk;
+}
+
+// Decodes the body of a single non-LIST chunk into new_chunk and sets its
+// ctype. Chunks that aren't recognized are left as GMM_UNKNOWN.
+static RESULT decode_chunk_payload(struct DecodingCursor *dc, uint32 ck_id,
+                                   GmmChunk *new_chunk,
+                                   struct DecodingContext *ctx) {
+  const GmmHandlerEntry *user = find_user_handler(ctx, ck_id);
+  if (user != NULL)
+    return decode_user_chunk(dc, new_chunk, ctx, user);
+  ChunkDecoder decode = builtin_decoder(ctx->list_type, ck_id);
+  if (decode == NULL)
+    return RES_OK;
+  return decode(dc, new_chunk, ctx);
+}
+
+RESULT _decode_chunks(struct DecodingCursor *dc, GmmChunkArray *out,
+                      struct DecodingContext *ctx);
+
+// Decides whether the "lvl " LIST with the given body (list type included)
+// and index in its "lvls" LIST is decoded. To select levels by name, the
+// "prop" chunk of the level is decoded on its own.
+static bool level_selected(const struct DecodingContext *ctx,
+                           struct DecodingCursor body, unsigned int index) {
+  const GmmSelection *sel = ctx->selection;
+  if (sel == NULL || (sel->num_level_indices == 0 && sel->num_level_names == 0))
+    return true;
+  for (size_t i = 0; i < sel->num_level_indices; ++i) {
+    if (sel->level_indices[i] == index)
+      return true;
+  }
+  if (sel->num_level_names == 0)
+    return false;
+  // Damaged levels are selected, so decoding them reports the error
+  if (cursor_take(&body, 4, NULL) == NULL)
+    return true;
+  while (cursor_remaining(&body) > 0) {
+    struct DecodingCursor chunk = body;
+    const struct ChunkHeader *header =
+        cursor_take(&chunk, sizeof(struct ChunkHeader), NULL);
+    if (skip_chunk(&body) < 0)
+      return true;
+    if (gmm_fourcc((const uint8 *)header->ckId) !=
+        GMM_FOURCC('p', 'r', 'o', 'p'))
+      continue;
+    chunk.end = chunk.pos + header->ckSize;
+    GmmError error = {RES_OK, ""};
+    struct DecodingContext peek;
+    memcpy(&peek, ctx, sizeof(struct DecodingContext));
+    peek.flags |= GMM_DECODE_STRING_VIEWS;
+    peek.error = &error;
+    peek.trace = NULL;
+    RiffChunkLevelProperties prop;
+    if (decode_lvl_prop_chunk(&chunk, &prop, &peek) < 0)
+      return true;
+    for (size_t i = 0; i < sel->num_level_names; ++i) {
+      if (strlen(sel->level_names[i]) == prop.level_name.len &&
+          memcmp(sel->level_names[i], prop.level_name.str,
+                 prop.level_name.len) == 0)
+        return true;
+    }
+    return false;
+  }
+  return false;
+}
+
+// False for the levels of a "lvls" LIST that aren't selected. level_index
+// counts the levels that were seen so far.
+static bool chunk_selected(const struct DecodingContext *ctx, uint32 ck_id,
+                           struct DecodingCursor body,
+                           unsigned int *level_index) {
+  if (ctx->list_type != GMM_FOURCC('l', 'v', 'l', 's') ||
+      ck_id != GMM_FOURCC('L', 'I', 'S', 'T'))
+    return true;
+  return level_selected(ctx, body, (*level_index)++);
+}
+
+// A child chunk of a "lvls" LIST that is decoded on the thread pool.
+struct LevelJob {
+  struct DecodingCursor cursor; // chunk header, body and alignment byte
+  GmmChunk *slot;               // where the decoded chunk goes
+  struct DecodingContext ctx;
+  Arena arena;    // adopted by the session arena after decoding
+  GmmError error; // the jobs don't share error state
+  // The layers of the session's selection, the level was selected already
+  GmmSelection selection;
+};
+
+static void decode_level_job(void *arg) {
+  struct LevelJob *job = arg;
+  GmmChunkArray decoded;
+  if (chunk_array_init_in(&decoded, &job->arena, 1) < 0) {
+    gmm_set_error(job->ctx.error, RES_OUT_OF_MEMORY, "Out of memory");
+    return;
+  }
+  if (_decode_chunks(&job->cursor, &decoded, &job->ctx) == RES_OK)
+    *job->slot = decoded.data[0];
+}
+
+// Decodes the children of a "lvls" LIST in parallel. The levels are
+// independent of each other, so a quick pass over the chunk headers finds
+// all of them, then every level is decoded by the thread pool into its
+// pre-allocated slot of out.
+RESULT decode_levels_parallel(struct DecodingCursor *dc, GmmChunkArray *out,
+                              struct DecodingContext *ctx) {
+  struct LevelJob *jobs = NULL;
+  ThreadPool *pool = NULL;
+  size_t num_children = 0;
+  size_t num_jobs = 0;
+
+  // Index pass, count the children first
+  struct DecodingCursor scan = *dc;
+  for (; cursor_remaining(&scan) > 0; ++num_children) {
+    GMM_CHECK(ctx->error, skip_chunk(&scan) < 0, RES_BAD_INPUT,
+              "Chunk at offset %zu doesn't fit into its parent. The file "
+              "might be damaged.",
+              cursor_offset(&scan));
+  }
+  const GmmAllocator *allocator = ctx->session_arena->allocator;
+  size_t jobs_size = num_children * sizeof(struct LevelJob);
+  jobs = gmm_alloc(allocator, jobs_size);
+  GMM_OOM(ctx->error, jobs);
+  memset(jobs, 0, jobs_size);
+  scan = *dc;
+  unsigned int level_index = 0;
+  for (size_t i = 0; i < num_children; ++i) {
+    struct DecodingCursor child = scan;
+    skip_chunk(&scan);
+    child.end = scan.pos;
+    const struct ChunkHeader *header = (const struct ChunkHeader *)child.pos;
+    struct DecodingCursor body = child;
+    body.pos += sizeof(struct ChunkHeader);
+    body.end = body.pos + header->ckSize;
+    if (!chunk_selected(ctx, gmm_fourcc((const uint8 *)header->ckId), body,
+                        &level_index))
+      continue;
+    struct LevelJob *job = &jobs[num_jobs++];
+    job->cursor = child;
+    memcpy(&job->ctx, ctx, sizeof(struct DecodingContext));
+    arena_init_with(&job->arena, ARENA_DEFAULT_BLOCK_SIZE, allocator);
+    job->ctx.arena = &job->arena;
+    job->ctx.error = &job->error;
+    job->ctx.threads = 1;
+    job->ctx.first_level = level_index - 1;
+    if (ctx->selection != NULL) {
+      job->selection.layers = ctx->selection->layers;
+      job->ctx.selection = &job->selection;
     }
-    *decoded_data = (const struct DecodedData *)*cursor.data;
-    advance_cursor(cursor, sizeof(struct DecodedData));
-    PROPAGATEERR();
+  }
+  // All slots exist before the workers start, so out never moves under them
+  GMM_CHECK(ctx->error, chunk_array_reserve(out, out->len + num_jobs) < 0,
+            RES_OUT_OF_MEMORY, "Out of memory");
+  for (size_t i = 0; i < num_jobs; ++i) {
+    jobs[i].slot = chunk_array_push(out);
+    jobs[i].slot->ctype = GMM_UNKNOWN;
+  }
 
-    out->records[i].src_level_index = decoded_data->src_level_index;
-    out->records[i].src_row = decoded_data->src_row;
-    out->records[i].src_column = decoded_data->src_column;
-    out->records[i].dest_level_index = decoded_data->dest_level_index;
-    out->records[i].dest_row = decoded_data->dest_row;
-    out->records[i].dest_column = decoded_data->dest_column;
+  unsigned int threads =
+      num_jobs < ctx->threads ? (unsigned int)num_jobs : ctx->threads;
+  pool = threadpool_create(threads);
+  GMM_CHECK(ctx->error, pool == NULL, RES_ERR,
+            "Couldn't start decoding threads.");
+  for (size_t i = 0; i < num_jobs; ++i) {
+    GMM_CHECK(ctx->error,
+              threadpool_submit(pool, decode_level_job, &jobs[i]) < 0,
+              RES_OUT_OF_MEMORY, "Couldn't queue level %zu for decoding.", i);
   }
+  threadpool_destroy(pool);
+  pool = NULL;
 
-  return *cursor.data - start_addr;
-onpropagate:
-onoom:
-  exit(EXIT_FAILURE);
+  for (size_t i = 0; i < num_jobs; ++i) {
+    arena_adopt(ctx->arena, &jobs[i].arena);
+    if (jobs[i].error.code < 0 && ctx->error->code == RES_OK)
+      *ctx->error = jobs[i].error;
+  }
+  gmm_free(allocator, jobs, jobs_size);
+  dc->pos = dc->end;
+  return ctx->error->code;
+onerror:
+  // wait for the jobs that were queued already, they use jobs
+  threadpool_destroy(pool);
+  if (jobs != NULL) {
+    for (size_t i = 0; i < num_jobs; ++i)
+      arena_adopt(ctx->arena, &jobs[i].arena);
+  }
+  gmm_free(allocator, jobs, jobs_size);
+  return ctx->error->code;
 }
 
-// Decodes GMM RIFF chunks while advancing the data pointer
+// Decodes GMM RIFF chunks while advancing the cursor
 // Arguments:
-//    data (in/out) -> *data points to the data that needs to be decoded.
-//                     after return, *data will point to the undecoded tail.
-//    len (in/out)  -> *len is the length of the **data array.
-//                     after return, *len will have the length of undecoded
-//                     tail.
-//    out (out)     -> *out is a dynarray of GmmChunk s. You have to initialize
-//    one with make_dynarray,
-//                     then pass it to this function.
+//    dc (in/out)   -> range of the data that needs to be decoded. After
+//                     return, dc->pos points to the undecoded tail.
+//    out (out)     -> the decoded chunks are appended to *out, which has to
+//                     be initialized. Reserve room for the chunks in dc,
+//                     see count_chunks, to never reallocate it.
 //    ctx (in)      -> context that is needed to decode some of the chunks.
-//    Internal var, if you call
-//                     it yourself, just pass NULL.
 //
-// Returns size_t length of decoded part of the *data array.
-size_t _decode_chunks(struct DecodingCursor dc, Dynarray *out,
+// Returns RES_OK, or the error code that is recorded in ctx->error.
+RESULT _decode_chunks(struct DecodingCursor *dc, GmmChunkArray *out,
                       struct DecodingContext *ctx) {
-  const char *ignore_list[] = {"disp", "opts", "tool", "notl", "\0"};
-
-  size_t decoded_length = 0;
-  while (*dc.len > 0) {
-    last_error = 0;
-    CHECKERR(*dc.len < 4,
-             "Unexpected end of a chunk. The file might be damaged.\n");
-    PACKED_STRUCT HeaderPacked {
-      char ckId[4];
-      uint32 ckSize;
-    }
-    *header = (struct HeaderPacked *)*dc.data;
-    decoded_length += sizeof(struct HeaderPacked);
-    advance_cursor(dc, sizeof(struct HeaderPacked));
-    CHECKRESULT("Unexpectedly run out of bytes while decoding");
-    size_t size_check = *dc.len;
+  unsigned int level_index = ctx->first_level;
+  while (dc->pos < dc->end) {
+    const struct ChunkHeader *header =
+        cursor_take(dc, sizeof(struct ChunkHeader), ctx->error);
+    GMM_PROPAGATE(ctx->error);
+    GMM_CHECK(ctx->error, header->ckSize > cursor_remaining(dc), RES_BAD_INPUT,
+              "Chunk %.4s of size %u at offset %zu doesn't fit into its "
+              "parent. The file might be damaged.",
+              header->ckId, header->ckSize, cursor_offset(dc));
+    // Whatever the decoders leave of the body is skipped with it
+    struct DecodingCursor body = cursor_sub(dc, header->ckSize, ctx->error);
+    uint32 ck_id = gmm_fourcc((const uint8 *)header->ckId);
+    // Levels that aren't selected are skipped as a whole
+    if (!chunk_selected(ctx, ck_id, body, &level_index))
+      goto skip_alignment;
 
-    GmmChunk *new_chunk = dynarray_push_inplace(out);
+    GmmChunk *new_chunk = chunk_array_push(out);
+    GMM_OOM(ctx->error, new_chunk);
     RiffChunkHeader *new_header = (RiffChunkHeader *)new_chunk;
-    strncpy((char *)new_header->ckId, header->ckId, 4);
+    memcpy(new_header->ckId, header->ckId, 4);
     new_header->ckSize = header->ckSize;
     new_chunk->ctype = GMM_UNKNOWN;
+    uint64_t start = ctx->trace != NULL ? gmm_trace_now() : 0;
 
-    // If the chunk type is on the ignore_list, we just skip it
-    bool ignore_this = false;
-    for (size_t i = 0; ignore_list[i][0] != '\0'; i++) {
-      if (strncmp(header->ckId, ignore_list[i], 4) == 0) {
-        ignore_this = true;
-        break;
-      }
-    }
-
-    if (ignore_this) {
-      // Advance by header.ckSize;
-      advance_cursor(dc, header->ckSize);
-      PROPAGATEERR();
-    } else if (strncmp(header->ckId, "LIST", 4) == 0) {
+    if (ck_id == GMM_FOURCC('L', 'I', 'S', 'T') &&
+        find_user_handler(ctx, ck_id) == NULL) {
       new_chunk->ctype = GMM_LIST;
-      // the list type is the next 4 bytes after the header
-      CHECKERR(*dc.len < 4,
-               "Unexpected end of a chunk. The file might be damaged.\n");
-      strncpy((char *)new_chunk->list_chunk.ckType, (const char *)*dc.data, 4);
-      decoded_length += 4;
-      advance_cursor(dc, 4);
-      CHECKRESULT("Unexpectedly run out of bytes while decoding");
-      new_chunk->list_chunk.children = make_dynarray(sizeof(GmmChunk), 1);
-      size_t list_len = header->ckSize - 4;
-      struct DecodingCursor nested_cursor =
-          recursive_cursor_from(&dc, &list_len);
-      PROPAGATEERR();
+      // the list type is the first 4 bytes of the body
+      const uint8 *list_type = cursor_take(&body, 4, ctx->error);
+      GMM_PROPAGATE(ctx->error);
+      memcpy(new_chunk->list_chunk.ckType, list_type, 4);
+      new_chunk->list_chunk.level_index =
+          ctx->list_type == GMM_FOURCC('l', 'v', 'l', 's') ? level_index - 1
+                                                           : 0;
+      GMM_CHECK(ctx->error,
+                chunk_array_init_in(&new_chunk->list_chunk.children,
+                                    ctx->arena, count_chunks(body)) < 0,
+                RES_OUT_OF_MEMORY, "Out of memory");
       struct DecodingContext new_ctx;
       memcpy(&new_ctx, ctx, sizeof(struct DecodingContext));
-      new_ctx.list_type = (const char *)new_chunk->list_chunk.ckType;
-      _decode_chunks(nested_cursor, &new_chunk->list_chunk.children, &new_ctx);
-      // advance len by the amount of bytes that were just read
-      // *dc.len -= header->ckSize - 4 - list_len;
-    } else if (strncmp(header->ckId, "prop", 4) == 0) {
-      // this is either map prop chunk or lvl prop chunk depending on context
-      if (strncmp(ctx->list_type, "map ", 4) == 0) {
-        new_chunk->ctype = GMM_MAP_PROP;
-        decoded_length += decode_map_prop_chunk(dc, &new_chunk->map_prop_chunk);
-      } else if (strncmp(ctx->list_type, "lvl ", 4) == 0) {
-        new_chunk->ctype = GMM_LVL_PROP;
-        decoded_length +=
-            decode_lvl_prop_chunk(dc, &new_chunk->level_prop_chunk);
-        size_t level_size = (new_chunk->level_prop_chunk.num_columns + 1) *
-                            (new_chunk->level_prop_chunk.num_rows + 1);
-        ctx->level_size = level_size;
-      }
-    } else if (strncmp(header->ckId, "coor", 4) == 0) {
-      if (strncmp(ctx->list_type, "map ", 4) == 0) {
-        new_chunk->ctype = GMM_MAP_COOR;
-        decoded_length += decode_map_coor_chunk(dc, &new_chunk->map_coor_chunk);
-      } else if (strncmp(ctx->list_type, "lvl ", 4) == 0) {
-        new_chunk->ctype = GMM_LVL_COOR;
-        decoded_length +=
-            decode_lvl_coor_chunk(dc, &new_chunk->level_coor_chunk);
-      }
-    } else if (strncmp(header->ckId, "cell", 4) == 0) {
-      new_chunk->ctype = GMM_LVL_CELL;
-      decoded_length += decode_lvl_cell_chunk(dc, &new_chunk->level_cell_chunk,
-                                              ctx->level_size);
-    } else if (strncmp(header->ckId, "anno", 4) == 0) {
-      new_chunk->ctype = GMM_LVL_ANNO;
-      decoded_length += decode_lvl_anno_chunk(dc, &new_chunk->level_anno_chunk);
-    } else if (strncmp(header->ckId, "lnks", 4) == 0) {
-      new_chunk->ctype = GMM_MAP_LINKS;
-      decoded_length += decode_map_links_chunk(dc, &new_chunk->map_links_chunk);
-    } else if (strncmp(header->ckId, "regn", 4) == 0) {
-      new_chunk->ctype = GMM_LVL_REGN;
-      decoded_length += decode_lvl_regn_chunk(dc, &new_chunk->level_regn_chunk);
-    }
-    if (!ignore_this && size_check - *dc.len != header->ckSize) {
-      long int size_defect = header->ckSize - (size_check - *dc.len);
-      // REally shouldn't happen, we decoded more bytes than the buffer length.
-      CHECKERR(header->ckSize < size_check - *dc.len,
-               "Suspected buffer overrun in _decode_chunks of size %ld. "
-               "Aborting...\n",
-               size_defect);
-      // printf("%ld bytes remain undecoded in chunk %.4s. Skipping...\n",
-      //       size_defect, header->ckId);
-
-      advance_cursor(dc, size_defect);
-      decoded_length += size_defect;
+      new_ctx.list_type = gmm_fourcc(list_type);
+      if (ctx->threads > 1 &&
+          new_ctx.list_type == GMM_FOURCC('l', 'v', 'l', 's'))
+        decode_levels_parallel(&body, &new_chunk->list_chunk.children,
+                               &new_ctx);
+      else
+        _decode_chunks(&body, &new_chunk->list_chunk.children, &new_ctx);
+      if (ctx->trace != NULL &&
+          ctx->list_type == GMM_FOURCC('l', 'v', 'l', 's') &&
+          new_ctx.list_type == GMM_FOURCC('l', 'v', 'l', ' '))
+        gmm_trace_level(ctx->trace, GMM_STAGE_DECODE, level_index - 1, start);
+    } else {
+      decode_chunk_payload(&body, ck_id, new_chunk, ctx);
+      if (ctx->trace != NULL)
+        gmm_trace_chunk(ctx->trace, new_chunk->ctype, header->ckSize, start);
     }
+    GMM_PROPAGATE(ctx->error);
+  skip_alignment:
     // Chunks are word aligned, so we need to skip 1 byte if necessary
-    if (header->ckSize % 2 == 1) {
-      advance_cursor(dc, 1);
-      decoded_length += 1;
-    }
+    if (header->ckSize % 2 == 1 && dc->pos < dc->end)
+      dc->pos += 1;
   }
-  return decoded_length;
+  return RES_OK;
 onpropagate:
 onerror:
-  exit(EXIT_FAILURE);
+  return ctx->error->code;
 }
 
-Dynarray decode_chunks(RiffFile *file) {
-  Dynarray result = make_dynarray(sizeof(GmmChunk), 2);
-  const uint8 *file_data = file->data;
-  size_t data_size = file->length;
-  struct DecodingCursor cursor = {&file_data, &data_size, NULL};
-  struct DecodingContext ctx = {0, NULL};
-  _decode_chunks(cursor, &result, &ctx);
-  return result;
+void gmm_session_init(GmmSession *session) {
+  gmm_session_init_with(session, NULL);
 }
 
-void free_chunks(Dynarray *chunk_array) {
-  for (unsigned int i = 0; i < dynarray_size(chunk_array); ++i) {
-    GmmChunk *ck = (GmmChunk *)dynarray_get(chunk_array, i);
-    switch (ck->ctype) {
-    case GMM_LIST:
-      free_chunks(&ck->list_chunk.children);
-      break;
-    case GMM_MAP_PROP:
-      free(ck->map_prop_chunk.author);
-      free(ck->map_prop_chunk.creation_time);
-      free(ck->map_prop_chunk.game);
-      free(ck->map_prop_chunk.notes);
-      free(ck->map_prop_chunk.title);
-      break;
-    default:
-      break;
+void gmm_session_init_with(GmmSession *session,
+                           const GmmAllocator *allocator) {
+  arena_init_with(&session->arena, ARENA_DEFAULT_BLOCK_SIZE, allocator);
+  session->flags = 0;
+  session->threads = 1;
+  session->selection = NULL;
+  session->trace = NULL;
+  session->error.code = RES_OK;
+  session->error.message[0] = '\0';
+  if (handler_array_init_in(&session->handlers, &session->arena, 4) < 0)
+    gmm_set_error(&session->error, RES_OUT_OF_MEMORY, "Out of memory");
+}
+
+RESULT gmm_session_register_handler(GmmSession *session, uint32 list_type,
+                                    uint32 ck_id, GmmChunkHandler handler,
+                                    void *user_data) {
+  if (session->error.code < 0)
+    return session->error.code;
+  if (handler == NULL)
+    return RES_BAD_INPUT;
+  GmmHandlerEntry entry = {list_type, ck_id, handler, user_data};
+  // a handler registered later replaces an earlier one for the same chunk
+  for (size_t i = 0; i < session->handlers.len; ++i) {
+    GmmHandlerEntry *old = &session->handlers.data[i];
+    if (old->list_type == list_type && old->ck_id == ck_id) {
+      *old = entry;
+      return RES_OK;
     }
   }
-  dynarray_free(chunk_array);
+  return handler_array_append(&session->handlers, &entry);
+}
+
+void gmm_session_release(GmmSession *session) {
+  arena_release(&session->arena);
 }
 
-RiffFile read_riff(FILE *fstr, const Context *ctx) {
+RESULT decode_chunks(RiffFile *file, GmmSession *session, GmmChunkArray *out) {
+  if (session->error.code < 0)
+    return session->error.code;
+  struct DecodingCursor cursor = make_cursor(file->data, (size_t)file->length);
+  size_t count = count_chunks(cursor);
+  GMM_CHECK(&session->error,
+            chunk_array_init_in(out, &session->arena, count) < 0,
+            RES_OUT_OF_MEMORY, "Out of memory");
+  struct DecodingContext ctx = {0,
+                                0,
+                                &session->arena,
+                                &session->arena,
+                                session->flags,
+                                session->threads,
+                                &session->handlers,
+                                &session->error,
+                                &session->error,
+                                session->selection,
+                                session->trace,
+                                0};
+  return _decode_chunks(&cursor, out, &ctx);
+onerror:
+  return session->error.code;
+}
+
+RESULT read_riff(FILE *fstr, const Context *ctx, GmmSession *session,
+                 RiffFile *out) {
   PACKED_STRUCT {
     uint8 ckId[4];
     uint32 ckSize;
     uint8 formType[4];
   }
   header;
+  GmmError *error = &session->error;
   // read the RIFF header of GMM file
-  RiffFile result = {0, NULL};
+  const GmmAllocator *allocator = session->arena.allocator;
+  RiffFile result = {0, NULL, NULL, 0, allocator};
   size_t readlen = fread(&header, sizeof(header), 1, fstr);
-  uint32 remainder_len;
+  size_t remainder_len;
   uint8 *remainder_bytes = NULL;
 
-  CHECKERR(readlen == 0, "Couldn't read data from file: %s", ctx->file_name);
+  GMM_CHECK(error, readlen == 0, RES_ERR, "Couldn't read data from file: %s",
+            ctx->file_name);
   // Check for correct bytes
-  CHECKERR(strncmp((const char *)header.ckId, "RIFF", 4),
-           "The file %s is not a RIFF file", ctx->file_name);
-  CHECKERR(strncmp((const char *)header.formType, "GRMM", 4),
-           "The file %s is not a valid GMM file", ctx->file_name);
+  GMM_CHECK(error, strncmp((const char *)header.ckId, "RIFF", 4),
+            RES_BAD_INPUT, "The file %s is not a RIFF file", ctx->file_name);
+  GMM_CHECK(error, strncmp((const char *)header.formType, "GRMM", 4),
+            RES_BAD_INPUT, "The file %s is not a valid GMM file",
+            ctx->file_name);
   // subtract 4, because we already read 4 bytes of the data chunk
   // add a byte to fulfill alignment requirement.
-  remainder_len = header.ckSize - 4 + header.ckSize % 2;
-  remainder_bytes = malloc(remainder_len);
-  OOMERROR(remainder_bytes);
+  GMM_CHECK(error, header.ckSize < 4, RES_BAD_INPUT,
+            "The file %s has a truncated RIFF header", ctx->file_name);
+  remainder_len = (size_t)header.ckSize - 4 + header.ckSize % 2;
+  remainder_bytes = gmm_alloc(allocator, remainder_len);
+  GMM_OOM(error, remainder_bytes);
   readlen = fread(remainder_bytes, 1, remainder_len, fstr);
-  if (readlen != remainder_len) {
-    printf("Expected to read %u bytes, read only %u bytes.\n", remainder_len,
-           (unsigned int)readlen);
-    goto onerror;
-  }
+  GMM_CHECK(error, readlen != remainder_len, RES_BAD_INPUT,
+            "Expected to read %zu bytes from file %s, read only %zu bytes.",
+            remainder_len, ctx->file_name, readlen);
 
   result.length = remainder_len;
   result.data = remainder_bytes;
-  return result;
+  *out = result;
+  return RES_OK;
 onerror:
-  if (remainder_bytes)
-    free(remainder_bytes);
-onoom:
-  exit(EXIT_FAILURE);
+  gmm_free(allocator, remainder_bytes, remainder_len);
+  return error->code;
+}
+
+RESULT map_riff(const char *path, const Context *ctx, GmmSession *session,
+                RiffFile *out) {
+  GmmError *error = &session->error;
+#ifdef _WIN32
+  FILE *fstr = fopen(path, "rb");
+  GMM_CHECK(error, fstr == NULL, RES_ERR, "Cannot open file %s", path);
+  RESULT res = read_riff(fstr, ctx, session, out);
+  fclose(fstr);
+  return res;
+onerror:
+  return error->code;
+#else
+  PACKED_STRUCT RiffHeader {
+    uint8 ckId[4];
+    uint32 ckSize;
+    uint8 formType[4];
+  };
+  struct stat st;
+  void *mapping = MAP_FAILED;
+  size_t file_len = 0;
+  int fd = open(path, O_RDONLY);
+  GMM_CHECK(error, fd < 0, RES_ERR, "Cannot open file %s", path);
+  GMM_CHECK(error, fstat(fd, &st) != 0, RES_ERR, "Cannot stat file %s", path);
+
+  if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+    // pipes, character devices etc. can't be mapped, read them instead
+    FILE *fstr = fdopen(fd, "rb");
+    GMM_CHECK(error, fstr == NULL, RES_ERR, "Cannot open file %s", path);
+    RESULT res = read_riff(fstr, ctx, session, out);
+    fclose(fstr);
+    return res;
+  }
+
+  file_len = (size_t)st.st_size;
+  GMM_CHECK(error, file_len < sizeof(struct RiffHeader), RES_BAD_INPUT,
+            "Couldn't read data from file: %s", ctx->file_name);
+  mapping = mmap(NULL, file_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  GMM_CHECK(error, mapping == MAP_FAILED, RES_ERR,
+            "Cannot map file %s into memory", path);
+  close(fd);
+  fd = -1;
+  // The decoder walks the file front to back exactly once.
+  madvise(mapping, file_len, MADV_SEQUENTIAL);
+  madvise(mapping, file_len, MADV_WILLNEED);
+
+  const struct RiffHeader *header = (const struct RiffHeader *)mapping;
+  GMM_CHECK(error, strncmp((const char *)header->ckId, "RIFF", 4),
+            RES_BAD_INPUT, "The file %s is not a RIFF file", ctx->file_name);
+  GMM_CHECK(error, strncmp((const char *)header->formType, "GRMM", 4),
+            RES_BAD_INPUT, "The file %s is not a valid GMM file",
+            ctx->file_name);
+  GMM_CHECK(error, header->ckSize < 4, RES_BAD_INPUT,
+            "The file %s has a truncated RIFF header", ctx->file_name);
+  // ckSize counts the form type, which is already part of the header.
+  uint64 body_len = (uint64)header->ckSize - 4;
+  GMM_CHECK(error, body_len > file_len - sizeof(struct RiffHeader),
+            RES_BAD_INPUT,
+            "Expected %llu bytes of data in file %s, found only %zu.",
+            body_len, ctx->file_name, file_len - sizeof(struct RiffHeader));
+
+  out->length = body_len;
+  out->data = (const uint8 *)mapping + sizeof(struct RiffHeader);
+  out->mapping = mapping;
+  out->mapping_len = file_len;
+  out->allocator = session->arena.allocator;
+  return RES_OK;
+onerror:
+  if (mapping != MAP_FAILED)
+    munmap(mapping, file_len);
+  if (fd >= 0)
+    close(fd);
+  return error->code;
+#endif
+}
+
+struct GmmStreamFrame {
+  GmmChunk list;    // LIST chunk that is handed out again on LIST_LEAVE
+  uint64 remaining; // bytes of the list body that weren't consumed yet
+  uint8 padding;    // alignment byte that follows the list body
+};
+
+struct GmmStream {
+  int fd;
+  const Context *ctx;
+  uint8 *buffer; // GMM_STREAM_BUFFER_SIZE bytes
+  size_t buf_pos;
+  size_t buf_len;
+  uint8 *body; // body of the current chunk, grows up to the largest chunk
+  size_t body_cap;
+  GmmChunk current;
+  Arena arena; // memory of the current chunk
+  struct DecodingContext dctx;
+  GmmError error;
+  unsigned int depth;
+  // frames[0] is the RIFF body, frames[n] the n-th nested LIST
+  struct GmmStreamFrame frames[GMM_STREAM_MAX_DEPTH + 1];
+};
+
+// Reads exactly n bytes into dst. If dst is NULL, the bytes are skipped.
+static RESULT stream_read(GmmStream *s, uint8 *dst, size_t n) {
+  while (n > 0) {
+    if (s->buf_pos == s->buf_len) {
+      // Big reads bypass the buffer
+      bool direct = dst != NULL && n >= GMM_STREAM_BUFFER_SIZE;
+      uint8 *target = direct ? dst : s->buffer;
+      size_t want = direct ? n : GMM_STREAM_BUFFER_SIZE;
+      ssize_t got = read(s->fd, target, want);
+      if (got < 0 && errno == EINTR)
+        continue;
+      GMM_CHECK(&s->error, got < 0, RES_ERR,
+                "Couldn't read data from file: %s", s->ctx->file_name);
+      GMM_CHECK(&s->error, got == 0, RES_BAD_INPUT,
+                "Unexpected end of file %s", s->ctx->file_name);
+      if (direct) {
+        dst += got;
+        n -= (size_t)got;
+        continue;
+      }
+      s->buf_pos = 0;
+      s->buf_len = (size_t)got;
+    }
+    size_t avail = s->buf_len - s->buf_pos;
+    size_t take = avail < n ? avail : n;
+    if (dst != NULL) {
+      memcpy(dst, s->buffer + s->buf_pos, take);
+      dst += take;
+    }
+    s->buf_pos += take;
+    n -= take;
+  }
+  return RES_OK;
+onerror:
+  return s->error.code;
+}
+
+GmmStream *gmm_stream_open(int fd, const Context *ctx, GmmError *error) {
+  PACKED_STRUCT {
+    uint8 ckId[4];
+    uint32 ckSize;
+    uint8 formType[4];
+  }
+  header;
+  GmmStream *s = calloc(1, sizeof(GmmStream));
+  if (s == NULL) {
+    gmm_set_error(error, RES_OUT_OF_MEMORY, "Out of memory");
+    return NULL;
+  }
+  s->fd = fd;
+  s->ctx = ctx;
+  s->buffer = malloc(GMM_STREAM_BUFFER_SIZE);
+  GMM_OOM(&s->error, s->buffer);
+  s->current.ctype = GMM_UNKNOWN;
+  arena_init(&s->arena, ARENA_DEFAULT_BLOCK_SIZE);
+  s->dctx.arena = &s->arena;
+  s->dctx.session_arena = &s->arena;
+  // chunk bodies live exactly as long as the decoded chunk
+  s->dctx.flags = GMM_DECODE_STRING_VIEWS;
+  s->dctx.error = &s->error;
+  s->dctx.session_error = &s->error;
+
+  if (stream_read(s, (uint8 *)&header, sizeof(header)) < 0)
+    goto onerror;
+  GMM_CHECK(&s->error, strncmp((const char *)header.ckId, "RIFF", 4),
+            RES_BAD_INPUT, "The file %s is not a RIFF file", ctx->file_name);
+  GMM_CHECK(&s->error, strncmp((const char *)header.formType, "GRMM", 4),
+            RES_BAD_INPUT, "The file %s is not a valid GMM file",
+            ctx->file_name);
+  GMM_CHECK(&s->error, header.ckSize < 4, RES_BAD_INPUT,
+            "The file %s has a truncated RIFF header", ctx->file_name);
+  s->frames[0].remaining = (uint64)header.ckSize - 4;
+  return s;
+onerror:
+  if (error != NULL)
+    *error = s->error;
+  gmm_stream_close(s);
+  return NULL;
+}
+
+RESULT gmm_stream_next_chunk(GmmStream *s, GmmStreamEvent *event) {
+  PACKED_STRUCT {
+    char ckId[4];
+    uint32 ckSize;
+  }
+  header;
+  if (s->error.code < 0)
+    return s->error.code;
+  // the previous chunk is not needed anymore
+  arena_reset(&s->arena);
+
+  while (true) {
+    struct GmmStreamFrame *frame = &s->frames[s->depth];
+    if (frame->remaining == 0) {
+      if (s->depth == 0) {
+        event->type = GMM_EVENT_END;
+        event->depth = 0;
+        event->chunk = NULL;
+        return RES_OK;
+      }
+      if (stream_read(s, NULL, frame->padding) < 0)
+        goto onerror;
+      s->depth--;
+      event->type = GMM_EVENT_LIST_LEAVE;
+      event->depth = s->depth;
+      event->chunk = &frame->list;
+      return RES_OK;
+    }
+
+    GMM_CHECK(&s->error, frame->remaining < sizeof(header), RES_BAD_INPUT,
+              "Unexpected end of a chunk. The file might be damaged.");
+    if (stream_read(s, (uint8 *)&header, sizeof(header)) < 0)
+      goto onerror;
+    uint64 available = frame->remaining - sizeof(header);
+    GMM_CHECK(&s->error, header.ckSize > available, RES_BAD_INPUT,
+              "Chunk %.4s of size %u doesn't fit into its parent. The file "
+              "might be damaged.",
+              header.ckId, header.ckSize);
+    // The last chunk of the file may come without its alignment byte
+    uint8 padding = (header.ckSize % 2 == 1 && available > header.ckSize);
+    frame->remaining = available - header.ckSize - padding;
+
+    uint32 ck_id = gmm_fourcc((const uint8 *)header.ckId);
+    if (ck_id == GMM_FOURCC('L', 'I', 'S', 'T')) {
+      GMM_CHECK(&s->error, s->depth == GMM_STREAM_MAX_DEPTH, RES_BAD_INPUT,
+                "LIST chunks are nested too deep.");
+      GMM_CHECK(&s->error, header.ckSize < 4, RES_BAD_INPUT,
+                "LIST chunk of size %u is too small.", header.ckSize);
+      struct GmmStreamFrame *nested = &s->frames[s->depth + 1];
+      GmmChunk *list = &nested->list;
+      memcpy(list->list_chunk.head.ckId, header.ckId, 4);
+      list->list_chunk.head.ckSize = header.ckSize;
+      if (stream_read(s, list->list_chunk.ckType, 4) < 0)
+        goto onerror;
+      GmmChunkArray no_children = {NULL, 0, 0, NULL, &gmm_malloc_allocator};
+      list->list_chunk.children = no_children;
+      list->ctype = GMM_LIST;
+      nested->remaining = (uint64)header.ckSize - 4;
+      nested->padding = padding;
+
+      event->type = GMM_EVENT_LIST_ENTER;
+      event->depth = s->depth;
+      event->chunk = list;
+      s->depth++;
+      return RES_OK;
+    }
+
+    GmmChunk *chunk = &s->current;
+    memcpy(chunk->unknown_chunk.head.ckId, header.ckId, 4);
+    chunk->unknown_chunk.head.ckSize = header.ckSize;
+    chunk->ctype = GMM_UNKNOWN;
+    event->type = GMM_EVENT_CHUNK;
+    event->depth = s->depth;
+    event->chunk = chunk;
+
+    s->dctx.list_type =
+        s->depth > 0 ? gmm_fourcc(s->frames[s->depth].list.list_chunk.ckType)
+                     : 0;
+    if (is_ignored_chunk(&s->dctx, ck_id)) {
+      // handed out as an unknown chunk, but the body is never buffered
+      if (stream_read(s, NULL, (size_t)header.ckSize + padding) < 0)
+        goto onerror;
+      return RES_OK;
+    }
+
+    if (s->body_cap < header.ckSize) {
+      uint8 *new_body = realloc(s->body, header.ckSize);
+      GMM_OOM(&s->error, new_body);
+      s->body = new_body;
+      s->body_cap = header.ckSize;
+    }
+    if (stream_read(s, s->body, header.ckSize) < 0 ||
+        stream_read(s, NULL, padding) < 0)
+      goto onerror;
+
+    struct DecodingCursor cursor = make_cursor(s->body, header.ckSize);
+    return decode_chunk_payload(&cursor, ck_id, chunk, &s->dctx);
+  }
+onerror:
+  return s->error.code;
+}
+
+const GmmError *gmm_stream_error(const GmmStream *s) { return &s->error; }
+
+void gmm_stream_close(GmmStream *s) {
+  if (s == NULL)
+    return;
+  arena_release(&s->arena);
+  free(s->body);
+  free(s->buffer);
+  free(s);
+}
+
+const char *cell_layer_to_str(GmmCellLayer layer) {
+  static const char *layer_names[] = {
+      "floor",      "floor_orientation", "floor_color",
+      "wall_north", "wall_west",         "trail",
+  };
+  if (layer < GMM_LAYER_COUNT)
+    return layer_names[layer];
+  return "unknown_layer";
 }
 
 char *chunk_type_to_str(GmmChunkType ck_type) {
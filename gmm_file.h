@@ -23,6 +23,8 @@
 #include <stddef.h>
 #include <stdio.h>
 
+#include "arena.h"
+#include "defs.h"
 #include "dynarray.h"
 
 typedef unsigned char uint8;
@@ -30,13 +32,49 @@ typedef unsigned short uint16;
 typedef short int16;
 typedef unsigned int uint32;
 typedef int int32;
+typedef unsigned long long uint64;
+typedef long long int64;
+// String of a decoded chunk. Depending on the session flags, str either
+// points into the file data (not NUL terminated!) or to a NUL terminated
+// copy.
+typedef struct GmmString {
+  const char *str;
+  size_t len;
+} GmmString;
+
 typedef struct Context {
   char *file_name;
 } Context;
 
+// Error state of a session or stream. Only the first error is kept, errors
+// after it are usually consequences of it.
+#define GMM_ERROR_MESSAGE_SIZE 256
+typedef struct GmmError {
+  RESULT code; // RES_OK as long as nothing failed
+  char message[GMM_ERROR_MESSAGE_SIZE];
+} GmmError;
+
+// Records an error, unless error already holds one.
+__attribute__((format(printf, 3, 4))) void
+gmm_set_error(GmmError *error, RESULT code, const char *format, ...);
+
+// Integer id of a RIFF FourCC, GMM_FOURCC('p', 'r', 'o', 'p') for "prop".
+#define GMM_FOURCC(a, b, c, d)                                                 \
+  ((uint32)(uint8)(a) | ((uint32)(uint8)(b) << 8) |                            \
+   ((uint32)(uint8)(c) << 16) | ((uint32)(uint8)(d) << 24))
+// Matches any list type when registering a chunk handler
+#define GMM_FOURCC_ANY 0
+
+static inline uint32 gmm_fourcc(const uint8 *id) {
+  return GMM_FOURCC(id[0], id[1], id[2], id[3]);
+}
+
 typedef struct RiffFile {
-  uint16 length;
-  uint8 *data;
+  uint64 length;
+  const uint8 *data; // read-only view of the RIFF body (after form type)
+  void *mapping;     // base of the mmap'd file, NULL if data is allocated
+  size_t mapping_len;
+  const GmmAllocator *allocator; // of data, if it isn't mapped
 } RiffFile;
 
 typedef struct RiffChunkHeader {
@@ -44,11 +82,16 @@ typedef struct RiffChunkHeader {
   uint32 ckSize;
 } RiffChunkHeader;
 
+// Array of GmmChunk, its functions follow the definition of GmmChunk
+DYNARRAY_TYPE(GmmChunkArray, struct GmmChunk)
+
 typedef struct RiffChunkList {
   RiffChunkHeader head;
   uint8 ckType[4];
-  // children is an array with elements of type GmmChunk
-  Dynarray children;
+  GmmChunkArray children;
+  // For the "lvl " LISTs of decode_chunks, the index of the level in the map,
+  // which is kept when other levels aren't selected. 0 otherwise.
+  unsigned int level_index;
 } RiffChunkList;
 
 typedef struct RiffChunkUnknown {
@@ -58,11 +101,11 @@ typedef struct RiffChunkUnknown {
 typedef struct RiffChunkMapProperties {
   RiffChunkHeader head;
   uint16 version;
-  char *title;         // mallocd, freed in free_chunks
-  char *game;          // mallocd, freed in free_chunks
-  char *author;        // mallocd, freed in free_chunks
-  char *creation_time; // mallocd, freed in free_chunks
-  char *notes;         // mallocd, freed in free_chunks
+  GmmString title;
+  GmmString game;
+  GmmString author;
+  GmmString creation_time;
+  GmmString notes;
 } RiffChunkMapProperties;
 
 typedef struct RiffChunkMapCoords {
@@ -76,13 +119,13 @@ typedef struct RiffChunkMapCoords {
 
 typedef struct RiffChunkLevelProperties {
   RiffChunkHeader head;
-  char *location_name;
-  char *level_name;
+  GmmString location_name;
+  GmmString level_name;
   int16 elevation;
   uint16 num_rows;
   uint16 num_columns;
   uint8 override_coord_opts;
-  char *notes;
+  GmmString notes;
 } RiffChunkLevelProperties;
 
 typedef struct RiffChunkLevelCoords {
@@ -94,15 +137,56 @@ typedef struct RiffChunkLevelCoords {
   uint16 column_start;
 } RiffChunkLevelCoords;
 
+typedef enum GmmCellLayer {
+  GMM_LAYER_FLOOR = 0,
+  GMM_LAYER_FLOOR_ORIENTATION,
+  GMM_LAYER_FLOOR_COLOR,
+  GMM_LAYER_WALL_NORTH,
+  GMM_LAYER_WALL_WEST,
+  GMM_LAYER_TRAIL,
+  GMM_LAYER_COUNT,
+} GmmCellLayer;
+
+// How a cell layer is stored in the file
+typedef enum GmmCellCompression {
+  GMM_CELLS_RAW = 0,  // one byte per cell
+  GMM_CELLS_RLE = 1,  // Gridmonger's run length encoding
+  GMM_CELLS_ZERO = 2, // all cells are 0, there is no data
+} GmmCellCompression;
+
+#define GMM_LAYER_BIT(layer) (1u << (layer))
+#define GMM_LAYERS_ALL ((1u << GMM_LAYER_COUNT) - 1)
+
+typedef struct GmmStoredLayer {
+  GmmCellCompression compression;
+  const uint8 *data; // the cells or the RLE stream, NULL for GMM_CELLS_ZERO
+  size_t len;
+} GmmStoredLayer;
+
 typedef struct RiffChunkLevelCell {
   RiffChunkHeader head;
-  uint8 *floor;
-  uint8 *floor_orientation;
-  uint8 *floor_color;
-  uint8 *wall_north;
-  uint8 *wall_west;
-  uint8 *trail;
+  // Decoded layers. When decoding with GMM_DECODE_LAZY_CELLS these are NULL
+  // until the layer is requested with gmm_cell_layer.
+  union {
+    struct {
+      uint8 *floor;
+      uint8 *floor_orientation;
+      uint8 *floor_color;
+      uint8 *wall_north;
+      uint8 *wall_west;
+      uint8 *trail;
+    };
+    uint8 *layers[GMM_LAYER_COUNT];
+  };
+  // Encoded layers (compression type byte included) in the file data.
+  const uint8 *layer_data[GMM_LAYER_COUNT];
+  size_t layer_size[GMM_LAYER_COUNT];
+  Arena *arena;     // lazily decoded layers are allocated here
+  GmmError *error; // errors of lazy decoding are recorded here
   size_t cells_count;
+  // GMM_LAYER_BIT of the layers selected by the session's GmmSelection. The
+  // other layers aren't decoded, but gmm_cell_layer can still decode them.
+  unsigned int layer_mask;
 } RiffChunkLevelCell;
 
 typedef struct IndexedAnnotation {
@@ -111,7 +195,7 @@ typedef struct IndexedAnnotation {
 } IndexedAnnotation;
 
 typedef struct CustomIdAnnotation {
-  char *custom_id;
+  GmmString custom_id;
 } CustomIdAnnotation;
 
 typedef struct IconAnnotation {
@@ -134,7 +218,7 @@ typedef struct AnnotationRecord {
   uint16 row;
   uint16 column;
   AnnotationKind kind;
-  char *text;
+  GmmString text;
 
   union {
     IndexedAnnotation indexed;
@@ -151,8 +235,8 @@ typedef struct RiffChunkLevelAnno {
 } RiffChunkLevelAnno;
 
 typedef struct LevelRegionRecord {
-  char *name;
-  char *notes;
+  GmmString name;
+  GmmString notes;
 } LevelRegionRecord;
 
 typedef struct RiffChunkLevelRegn {
@@ -180,9 +264,17 @@ typedef struct RiffChunkMapLinks {
   MapLinksRecord *records;
 } RiffChunkMapLinks;
 
+// Chunk decoded by a handler that was registered with
+// gmm_session_register_handler.
+typedef struct RiffChunkCustom {
+  RiffChunkHeader head;
+  uint32 list_type; // FourCC of the enclosing LIST, 0 at the top level
+  void *data;       // whatever the handler decoded
+} RiffChunkCustom;
+
 static char *chunk_names[] = {
     "LIST",     "MAP_PROP", "MAP_COOR", "LVL_PROP",  "LVL_COOR",
-    "LVL_CELL", "LVL_ANNO", "LVL_REGN", "MAP_LINKS",
+    "LVL_CELL", "LVL_ANNO", "LVL_REGN", "MAP_LINKS", "CUSTOM",
 };
 
 typedef enum GmmChunkType {
@@ -195,6 +287,7 @@ typedef enum GmmChunkType {
   GMM_LVL_ANNO,
   GMM_LVL_REGN,
   GMM_MAP_LINKS,
+  GMM_CUSTOM,
   GMM_UNKNOWN = 255,
 } GmmChunkType;
 
@@ -210,18 +303,149 @@ typedef struct GmmChunk {
     RiffChunkLevelAnno level_anno_chunk;
     RiffChunkLevelRegn level_regn_chunk;
     RiffChunkMapLinks map_links_chunk;
+    RiffChunkCustom custom_chunk;
   };
   GmmChunkType ctype;
 } GmmChunk;
 
+DYNARRAY_FUNCTIONS(GmmChunkArray, GmmChunk, chunk_array)
+
+// Decodes the body of a chunk for which it was registered. body is len bytes
+// long. Memory for out->data should come from arena, so it is released with
+// the session. Returns RES_OK or a negative error code.
+typedef RESULT (*GmmChunkHandler)(const uint8 *body, size_t len,
+                                  RiffChunkCustom *out, Arena *arena,
+                                  void *user_data);
+
+typedef struct GmmHandlerEntry {
+  uint32 list_type; // GMM_FOURCC_ANY or FourCC of the enclosing LIST
+  uint32 ck_id;
+  GmmChunkHandler handler;
+  void *user_data;
+} GmmHandlerEntry;
+
+DYNARRAY(GmmHandlerArray, GmmHandlerEntry, handler_array)
+
+// Parts of the map that are decoded. Everything else is skipped by its size
+// in the file, without being decoded.
+typedef struct GmmSelection {
+  // Levels are selected by their index in the "lvls" LIST or by their
+  // level_name. Without indices and names, all levels are decoded.
+  const unsigned int *level_indices;
+  size_t num_level_indices;
+  const char *const *level_names;
+  size_t num_level_names;
+  // GMM_LAYER_BIT of every cell layer to decode, or GMM_LAYERS_ALL
+  unsigned int layers;
+} GmmSelection;
+
+// Statistics and trace events, see trace.h
+typedef struct GmmTrace GmmTrace;
+
+// Decode session. Owns all memory of the decoded chunk tree (strings, cell
+// layers, records and the children arrays), which is released with a single
+// gmm_session_release call. All memory of the session and of the files it
+// reads comes from the allocator of its arena.
+typedef struct GmmSession {
+  Arena arena;
+  unsigned int flags; // GMM_DECODE_* flags, 0 by default
+  // Number of threads that decode the levels of a "lvls" LIST in parallel.
+  // 1 by default, which decodes everything on the calling thread.
+  unsigned int threads;
+  GmmHandlerArray handlers; // see gmm_session_register_handler
+  // What to decode, NULL (the default) decodes everything. Has to stay valid
+  // while decoding.
+  const GmmSelection *selection;
+  // Records statistics of the decoding, NULL (the default) records nothing
+  GmmTrace *trace;
+  // Set when a call on the session fails. A failed session stays failed, it
+  // can only be released.
+  GmmError error;
+} GmmSession;
+
+// Strings are decoded as views into the RiffFile data instead of being copied.
+// The RiffFile has to outlive the decoded chunks then.
+#define GMM_DECODE_STRING_VIEWS 0x1
+// Cell layers are only decoded when they are requested with gmm_cell_layer.
+// The RiffFile has to outlive the decoded chunks then.
+#define GMM_DECODE_LAZY_CELLS 0x2
+
 struct DecodingCursor;
 struct DecodingContext;
 
+void gmm_session_init(GmmSession *session);
+// Takes all memory of the session from allocator, NULL uses malloc. When an
+// allocation fails, e.g. because the allocator enforces a memory budget,
+// the call fails with RES_OUT_OF_MEMORY.
+void gmm_session_init_with(GmmSession *session, const GmmAllocator *allocator);
+void gmm_session_release(GmmSession *session);
+// Decodes chunks with the given ckId (in a LIST of the given type) with
+// handler, instead of the built-in decoder. This also works for chunks that
+// are skipped by default, like "disp" or "opts". The streaming decoder only
+// uses the built-in decoders and decodes everything.
+RESULT gmm_session_register_handler(GmmSession *session, uint32 list_type,
+                                    uint32 ck_id, GmmChunkHandler handler,
+                                    void *user_data);
+
+// The functions below don't print anything and don't exit. Errors are
+// returned as negative RESULT codes and described in session->error, so a
+// process can decode any number of files at once, each with its own session.
+
 void free_gmmfile(RiffFile *);
-Dynarray decode_chunks(RiffFile *);
-void free_chunks(Dynarray *chunk_array);
+// Decodes the chunks of file into out. The array and all chunks in it are
+// allocated from the session.
+RESULT decode_chunks(RiffFile *file, GmmSession *session, GmmChunkArray *out);
 char *chunk_type_to_str(GmmChunkType ck_type);
-
-RiffFile read_riff(FILE *fstr, const Context *ctx);
+const char *cell_layer_to_str(GmmCellLayer layer);
+
+// Returns the decoded layer, decoding it on the first request. Returns NULL
+// if the layer data is damaged, the reason is recorded in the session error.
+// Not thread safe.
+const uint8 *gmm_cell_layer(RiffChunkLevelCell *cell, GmmCellLayer layer);
+// Returns the layer as it is stored in the file data, without decoding it.
+RESULT gmm_cell_layer_stored(const RiffChunkLevelCell *cell,
+                             GmmCellLayer layer, GmmStoredLayer *out);
+
+RESULT read_riff(FILE *fstr, const Context *ctx, GmmSession *session,
+                 RiffFile *out);
+// Maps the file into memory instead of reading it. Falls back to read_riff
+// for pipes and other files that can't be mapped.
+RESULT map_riff(const char *path, const Context *ctx, GmmSession *session,
+                RiffFile *out);
+
+// Streaming decoder.
+// Pulls chunks one by one from a file descriptor (a pipe works too) through a
+// fixed size read buffer. Only the body of the chunk that is currently being
+// decoded is kept in memory, so the peak memory usage is about the size of the
+// largest chunk (usually one level's cell data) instead of the whole file.
+#define GMM_STREAM_BUFFER_SIZE (64 * 1024)
+#define GMM_STREAM_MAX_DEPTH 16
+
+typedef enum GmmStreamEventType {
+  GMM_EVENT_CHUNK = 0,  // a decoded chunk that is not a LIST
+  GMM_EVENT_LIST_ENTER, // a LIST starts, its children follow as events
+  GMM_EVENT_LIST_LEAVE, // the last entered LIST ends
+  GMM_EVENT_END,        // no more chunks
+} GmmStreamEventType;
+
+typedef struct GmmStreamEvent {
+  GmmStreamEventType type;
+  unsigned int depth; // nesting level of the chunk, 0 for top level chunks
+  // Owned by the stream and valid until the next call to
+  // gmm_stream_next_chunk. LIST chunks are handed out without children.
+  GmmChunk *chunk;
+} GmmStreamEvent;
+
+typedef struct GmmStream GmmStream;
+
+// Reads and validates the RIFF header. Returns NULL on error, the reason is
+// recorded in *error.
+GmmStream *gmm_stream_open(int fd, const Context *ctx, GmmError *error);
+// Decodes the next chunk. Returns RES_OK and fills *event on success.
+RESULT gmm_stream_next_chunk(GmmStream *stream, GmmStreamEvent *event);
+// The error of the last failed gmm_stream_next_chunk call.
+const GmmError *gmm_stream_error(const GmmStream *stream);
+// Frees the stream. The file descriptor is not closed.
+void gmm_stream_close(GmmStream *stream);
 
 #endif // GMMFILE_H
@@ -0,0 +1,287 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#ifndef GMMB_H
+#define GMMB_H
+
+// GMMB, a flat binary form of a GMM map, and a reader for it.
+//
+// The file is made to be memory mapped and used as it is: every table is an
+// array of fixed size structs at a known offset, so nothing has to be parsed
+// or copied. All numbers are little endian, all offsets are in bytes from
+// the start of the file. The layout is
+//
+//   GmmbHeader                      at offset 0
+//   GmmbLevel[num_levels]           at levels_offset
+//   GmmbLink[num_links]             at links_offset
+//   GmmbAnnotation[num_annotations] at annotations_offset of each level
+//   GmmbRegion[num_regions]         at regions_offset of each level
+//   string table                    at strings_offset, strings_size bytes
+//   cell layers                     at layers_offset[] of each level
+//
+// Tables are aligned to GMMB_TABLE_ALIGN bytes. The cells of a level are
+// stored as one array of num_cells bytes per layer (structure of arrays),
+// each aligned to GMMB_LAYER_ALIGN bytes. The cell of row r and column c is
+// at index r * (num_columns + 1) + c.
+//
+// Strings are GmmbString references into the string table. The bytes are
+// UTF-8 and followed by a NUL, so they can be used as C strings.
+//
+// This header doesn't depend on the rest of gmm2json and can be copied into
+// other projects.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define GMMB_MAGIC "GMMB"
+#define GMMB_VERSION 2
+#define GMMB_TABLE_ALIGN 8
+#define GMMB_LAYER_ALIGN 64
+
+// Cell layers, in the order of GmmbLevel.layers_offset
+enum {
+  GMMB_LAYER_FLOOR = 0,
+  GMMB_LAYER_FLOOR_ORIENTATION,
+  GMMB_LAYER_FLOOR_COLOR,
+  GMMB_LAYER_WALL_NORTH,
+  GMMB_LAYER_WALL_WEST,
+  GMMB_LAYER_TRAIL,
+  GMMB_LAYER_COUNT,
+};
+
+// Kinds of annotations
+enum {
+  GMMB_ANNO_COMMENT = 0,
+  GMMB_ANNO_INDEXED,
+  GMMB_ANNO_CUSTOM,
+  GMMB_ANNO_ICON,
+  GMMB_ANNO_LABEL,
+};
+
+// Result codes of gmmb_open
+enum {
+  GMMB_OK = 0,
+  GMMB_ERR_FORMAT = -1,  // not a GMMB file
+  GMMB_ERR_VERSION = -2, // written by a newer gmm2json
+  GMMB_ERR_RANGE = -3,   // a table is outside of the file, it is truncated
+};
+
+typedef struct GmmbString {
+  uint32_t offset; // from the start of the string table
+  uint32_t len;    // in bytes, without the NUL
+} GmmbString;
+
+typedef struct GmmbCoords {
+  uint8_t origin;
+  uint8_t row_style;
+  uint8_t column_style;
+  uint8_t reserved;
+  uint16_t row_start;
+  uint16_t column_start;
+} GmmbCoords;
+
+typedef struct GmmbHeader {
+  char magic[4];    // GMMB_MAGIC
+  uint32_t version; // GMMB_VERSION
+  uint64_t file_size;
+  uint64_t levels_offset;
+  uint64_t links_offset;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+  uint32_t num_levels;
+  uint32_t num_links;
+  uint16_t map_version; // version of the GMM file
+  uint16_t reserved;
+  GmmbCoords coords;
+  uint32_t reserved2;
+  GmmbString title;
+  GmmbString game;
+  GmmbString author;
+  GmmbString creation_time;
+  GmmbString notes;
+} GmmbHeader;
+
+typedef struct GmmbLevel {
+  // 0 for all layers if the level has no cells, and for layers that weren't
+  // exported
+  uint64_t layers_offset[GMMB_LAYER_COUNT];
+  uint64_t annotations_offset;
+  uint64_t regions_offset;
+  GmmbString location_name;
+  GmmbString level_name;
+  GmmbString notes;
+  uint32_t num_cells; // (num_rows + 1) * (num_columns + 1)
+  uint32_t num_annotations;
+  uint32_t num_regions;
+  int16_t elevation;
+  uint16_t num_rows;
+  uint16_t num_columns;
+  uint16_t rows_per_region;
+  uint16_t columns_per_region;
+  uint8_t override_coord_opts; // coords is used instead of the map's
+  uint8_t enable_regions;
+  uint8_t per_region_coords;
+  uint8_t reserved[3];
+  GmmbCoords coords;
+  // of the level in the map, which links refer to. It differs from the
+  // position in the level table if only some levels were exported.
+  uint32_t index;
+} GmmbLevel;
+
+typedef struct GmmbAnnotation {
+  GmmbString text;
+  GmmbString custom_id; // GMMB_ANNO_CUSTOM only
+  uint16_t row;
+  uint16_t column;
+  uint16_t index; // GMMB_ANNO_INDEXED only
+  uint8_t kind;   // GMMB_ANNO_*
+  // index_color for GMMB_ANNO_INDEXED, label_color for GMMB_ANNO_LABEL
+  uint8_t color;
+  uint8_t icon; // GMMB_ANNO_ICON only
+  uint8_t reserved[3];
+} GmmbAnnotation;
+
+typedef struct GmmbRegion {
+  GmmbString name;
+  GmmbString notes;
+} GmmbRegion;
+
+typedef struct GmmbLink {
+  uint16_t src_level_index;
+  uint16_t src_row;
+  uint16_t src_column;
+  uint16_t dest_level_index;
+  uint16_t dest_row;
+  uint16_t dest_column;
+} GmmbLink;
+
+// The sizes are part of the format
+_Static_assert(sizeof(GmmbHeader) == 112, "GmmbHeader has padding");
+_Static_assert(sizeof(GmmbLevel) == 128, "GmmbLevel has padding");
+_Static_assert(sizeof(GmmbAnnotation) == 28, "GmmbAnnotation has padding");
+_Static_assert(sizeof(GmmbRegion) == 16, "GmmbRegion has padding");
+_Static_assert(sizeof(GmmbLink) == 12, "GmmbLink has padding");
+
+// An opened GMMB file. It only points into the data passed to gmmb_open.
+typedef struct GmmbMap {
+  const uint8_t *data;
+  size_t size;
+  const GmmbHeader *header;
+  const GmmbLevel *levels;
+  const GmmbLink *links;
+  const char *strings;
+} GmmbMap;
+
+static inline int gmmb_in_range(const GmmbMap *map, uint64_t offset,
+                                uint64_t count, size_t elsize,
+                                size_t align) {
+  if (offset % align != 0 || offset > map->size)
+    return 0;
+  return count <= (map->size - offset) / elsize;
+}
+
+// Checks the header and that all tables are inside of the data, which has to
+// be aligned to GMMB_LAYER_ALIGN bytes (mmap'd memory always is). This is the
+// only validation, afterwards the accessors below can be used freely. Returns
+// GMMB_OK or one of the GMMB_ERR codes.
+static inline int gmmb_open(GmmbMap *map, const void *data, size_t size) {
+  const GmmbHeader *header = (const GmmbHeader *)data;
+  if (size < sizeof(GmmbHeader) || memcmp(header->magic, GMMB_MAGIC, 4) != 0)
+    return GMMB_ERR_FORMAT;
+  if (header->version != GMMB_VERSION)
+    return GMMB_ERR_VERSION;
+  if (header->file_size > size)
+    return GMMB_ERR_RANGE;
+  map->data = (const uint8_t *)data;
+  map->size = (size_t)header->file_size;
+  map->header = header;
+  if (!gmmb_in_range(map, header->levels_offset, header->num_levels,
+                     sizeof(GmmbLevel), GMMB_TABLE_ALIGN) ||
+      !gmmb_in_range(map, header->links_offset, header->num_links,
+                     sizeof(GmmbLink), GMMB_TABLE_ALIGN) ||
+      !gmmb_in_range(map, header->strings_offset, header->strings_size, 1, 1))
+    return GMMB_ERR_RANGE;
+  map->levels = (const GmmbLevel *)(map->data + header->levels_offset);
+  map->links = (const GmmbLink *)(map->data + header->links_offset);
+  map->strings = (const char *)(map->data + header->strings_offset);
+
+  for (uint32_t i = 0; i < header->num_levels; ++i) {
+    const GmmbLevel *level = &map->levels[i];
+    for (int l = 0; l < GMMB_LAYER_COUNT; ++l) {
+      if (level->layers_offset[l] != 0 &&
+          !gmmb_in_range(map, level->layers_offset[l], level->num_cells, 1,
+                         GMMB_LAYER_ALIGN))
+        return GMMB_ERR_RANGE;
+    }
+    if (!gmmb_in_range(map, level->annotations_offset, level->num_annotations,
+                       sizeof(GmmbAnnotation), GMMB_TABLE_ALIGN) ||
+        !gmmb_in_range(map, level->regions_offset, level->num_regions,
+                       sizeof(GmmbRegion), GMMB_TABLE_ALIGN))
+      return GMMB_ERR_RANGE;
+  }
+  return GMMB_OK;
+}
+
+// Returns the NUL terminated string, or NULL if the reference is broken.
+static inline const char *gmmb_string(const GmmbMap *map, GmmbString s) {
+  uint64_t end = (uint64_t)s.offset + s.len;
+  if (end >= map->header->strings_size || map->strings[end] != '\0')
+    return NULL;
+  return map->strings + s.offset;
+}
+
+static inline const GmmbLevel *gmmb_level(const GmmbMap *map, uint32_t index) {
+  return index < map->header->num_levels ? &map->levels[index] : NULL;
+}
+
+// Returns the level with the given GmmbLevel.index, as in GmmbLink, or NULL
+// if it wasn't exported.
+static inline const GmmbLevel *gmmb_find_level(const GmmbMap *map,
+                                               uint32_t index) {
+  const GmmbLevel *level = gmmb_level(map, index);
+  if (level != NULL && level->index == index)
+    return level;
+  for (uint32_t i = 0; i < map->header->num_levels; ++i) {
+    if (map->levels[i].index == index)
+      return &map->levels[i];
+  }
+  return NULL;
+}
+
+// Returns num_cells bytes, or NULL if the level has no cells.
+static inline const uint8_t *gmmb_layer(const GmmbMap *map,
+                                        const GmmbLevel *level, int layer) {
+  if (layer < 0 || layer >= GMMB_LAYER_COUNT ||
+      level->layers_offset[layer] == 0)
+    return NULL;
+  return map->data + level->layers_offset[layer];
+}
+
+static inline const GmmbAnnotation *gmmb_annotations(const GmmbMap *map,
+                                                     const GmmbLevel *level) {
+  return (const GmmbAnnotation *)(map->data + level->annotations_offset);
+}
+
+static inline const GmmbRegion *gmmb_regions(const GmmbMap *map,
+                                             const GmmbLevel *level) {
+  return (const GmmbRegion *)(map->data + level->regions_offset);
+}
+
+#endif // GMMB_H
@@ -0,0 +1,381 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#include <stdint.h>
+#include <string.h>
+
+#include "gmmb.h"
+#include "gmmb_writer.h"
+
+// The decoded structs are copied field by field, except for the link records
+// which already have the layout of the file.
+_Static_assert(sizeof(MapLinksRecord) == sizeof(GmmbLink),
+               "MapLinksRecord doesn't match GmmbLink");
+_Static_assert((int)GMM_LAYER_COUNT == (int)GMMB_LAYER_COUNT,
+               "cell layers don't match");
+_Static_assert((int)AK_LABEL == (int)GMMB_ANNO_LABEL,
+               "annotation kinds don't match");
+
+// The chunks of one "lvl " LIST and the tables built from them
+struct LevelChunks {
+  unsigned int index; // of the level in the map
+  RiffChunkLevelProperties *prop;
+  RiffChunkLevelCoords *coords;
+  RiffChunkLevelCell *cell;
+  RiffChunkLevelAnno *anno;
+  RiffChunkLevelRegn *regn;
+  GmmbAnnotation *annotations;
+  GmmbRegion *regions;
+};
+
+DYNARRAY(LevelChunksArray, struct LevelChunks, level_chunks_array)
+DYNARRAY(GmmStringArray, GmmString, string_array)
+
+struct GmmbBuilder {
+  RiffChunkMapProperties *map_prop;
+  RiffChunkMapCoords *map_coords;
+  RiffChunkMapLinks *links;
+  LevelChunksArray levels;
+  GmmStringArray strings; // in the order of the string table
+  uint64 strings_size;
+  FILE *out;
+  uint64 written; // bytes written to out
+  Arena *arena;
+  GmmError *error;
+};
+
+static uint64 align_up(uint64 offset, uint64 align) {
+  return (offset + align - 1) / align * align;
+}
+
+// Finds the chunks of the map. level is the "lvl " LIST that chunks belong
+// to, or NULL outside of levels.
+static RESULT collect_chunks(struct GmmbBuilder *b, GmmChunkArray *chunks,
+                             struct LevelChunks *level) {
+  for (size_t i = 0; i < chunks->len; ++i) {
+    GmmChunk *ck = &chunks->data[i];
+    switch (ck->ctype) {
+    case GMM_LIST:
+      if (gmm_fourcc(ck->list_chunk.ckType) ==
+          GMM_FOURCC('l', 'v', 'l', ' ')) {
+        struct LevelChunks found = {0};
+        found.index = ck->list_chunk.level_index;
+        RESULT res = collect_chunks(b, &ck->list_chunk.children, &found);
+        if (res < 0)
+          return res;
+        if (level_chunks_array_append(&b->levels, &found) < 0)
+          return RES_OUT_OF_MEMORY;
+      } else {
+        RESULT res = collect_chunks(b, &ck->list_chunk.children, level);
+        if (res < 0)
+          return res;
+      }
+      break;
+    case GMM_MAP_PROP:
+      b->map_prop = &ck->map_prop_chunk;
+      break;
+    case GMM_MAP_COOR:
+      b->map_coords = &ck->map_coor_chunk;
+      break;
+    case GMM_MAP_LINKS:
+      b->links = &ck->map_links_chunk;
+      break;
+    case GMM_LVL_PROP:
+      if (level != NULL)
+        level->prop = &ck->level_prop_chunk;
+      break;
+    case GMM_LVL_COOR:
+      if (level != NULL)
+        level->coords = &ck->level_coor_chunk;
+      break;
+    case GMM_LVL_CELL:
+      if (level != NULL)
+        level->cell = &ck->level_cell_chunk;
+      break;
+    case GMM_LVL_ANNO:
+      if (level != NULL)
+        level->anno = &ck->level_anno_chunk;
+      break;
+    case GMM_LVL_REGN:
+      if (level != NULL)
+        level->regn = &ck->level_regn_chunk;
+      break;
+    default:
+      break;
+    }
+  }
+  return RES_OK;
+}
+
+// Appends s to the string table.
+static RESULT add_string(struct GmmbBuilder *b, GmmString s, GmmbString *out) {
+  if (b->strings_size + s.len + 1 > UINT32_MAX) {
+    gmm_set_error(b->error, RES_ERR, "Too many strings for a GMMB file");
+    return RES_ERR;
+  }
+  out->offset = (uint32)b->strings_size;
+  out->len = (uint32)s.len;
+  b->strings_size += s.len + 1;
+  if (string_array_append(&b->strings, &s) < 0) {
+    gmm_set_error(b->error, RES_OUT_OF_MEMORY, "Out of memory");
+    return RES_OUT_OF_MEMORY;
+  }
+  return RES_OK;
+}
+
+static void copy_coords(GmmbCoords *out, uint8 origin, uint8 row_style,
+                        uint8 column_style, uint16 row_start,
+                        uint16 column_start) {
+  out->origin = origin;
+  out->row_style = row_style;
+  out->column_style = column_style;
+  out->row_start = row_start;
+  out->column_start = column_start;
+}
+
+// Fills in everything of the level except for the offsets.
+static RESULT build_level(struct GmmbBuilder *b, struct LevelChunks *chunks,
+                          GmmbLevel *level) {
+  RiffChunkLevelProperties no_prop = {0};
+  const RiffChunkLevelProperties *prop =
+      chunks->prop != NULL ? chunks->prop : &no_prop;
+  uint64 num_cells = chunks->cell != NULL ? chunks->cell->cells_count : 0;
+  if (num_cells > UINT32_MAX) {
+    gmm_set_error(b->error, RES_ERR, "Level is too big for a GMMB file");
+    return RES_ERR;
+  }
+  RESULT res;
+  if ((res = add_string(b, prop->location_name, &level->location_name)) < 0 ||
+      (res = add_string(b, prop->level_name, &level->level_name)) < 0 ||
+      (res = add_string(b, prop->notes, &level->notes)) < 0)
+    return res;
+  level->index = chunks->index;
+  level->num_cells = (uint32)num_cells;
+  level->elevation = prop->elevation;
+  level->num_rows = prop->num_rows;
+  level->num_columns = prop->num_columns;
+  level->override_coord_opts = prop->override_coord_opts;
+  if (chunks->coords != NULL) {
+    const RiffChunkLevelCoords *c = chunks->coords;
+    copy_coords(&level->coords, c->origin, c->row_style, c->column_style,
+                c->row_start, c->column_start);
+  }
+
+  if (chunks->anno != NULL) {
+    const RiffChunkLevelAnno *anno = chunks->anno;
+    level->num_annotations = anno->num_annotations;
+    chunks->annotations =
+        arena_alloc(b->arena, anno->num_annotations * sizeof(GmmbAnnotation));
+    if (chunks->annotations == NULL)
+      goto onoom;
+    for (size_t i = 0; i < anno->num_annotations; ++i) {
+      const AnnotationRecord *record = &anno->records[i];
+      GmmbAnnotation *out = &chunks->annotations[i];
+      memset(out, 0, sizeof(GmmbAnnotation));
+      out->row = record->row;
+      out->column = record->column;
+      out->kind = (uint8)record->kind;
+      GmmString custom_id = {NULL, 0};
+      switch (record->kind) {
+      case AK_COMMENT:
+        break;
+      case AK_INDEXED:
+        out->index = record->indexed.index;
+        out->color = record->indexed.index_color;
+        break;
+      case AK_CUSTOM:
+        custom_id = record->custom.custom_id;
+        break;
+      case AK_ICON:
+        out->icon = record->icon.icon;
+        break;
+      case AK_LABEL:
+        out->color = record->label.label_color;
+        break;
+      }
+      if ((res = add_string(b, record->text, &out->text)) < 0 ||
+          (res = add_string(b, custom_id, &out->custom_id)) < 0)
+        return res;
+    }
+  }
+
+  if (chunks->regn != NULL) {
+    const RiffChunkLevelRegn *regn = chunks->regn;
+    level->num_regions = regn->num_regions;
+    level->enable_regions = regn->enable_regions;
+    level->rows_per_region = regn->rows_per_region;
+    level->columns_per_region = regn->columns_per_region;
+    level->per_region_coords = regn->per_region_coords;
+    chunks->regions =
+        arena_alloc(b->arena, regn->num_regions * sizeof(GmmbRegion));
+    if (chunks->regions == NULL)
+      goto onoom;
+    for (size_t i = 0; i < regn->num_regions; ++i) {
+      const LevelRegionRecord *record = &regn->records[i];
+      GmmbRegion *out = &chunks->regions[i];
+      if ((res = add_string(b, record->name, &out->name)) < 0 ||
+          (res = add_string(b, record->notes, &out->notes)) < 0)
+        return res;
+    }
+  }
+  return RES_OK;
+
+onoom:
+  gmm_set_error(b->error, RES_OUT_OF_MEMORY, "Out of memory");
+  return RES_OUT_OF_MEMORY;
+}
+
+static void put(struct GmmbBuilder *b, const void *data, size_t len) {
+  if (len > 0)
+    fwrite(data, 1, len, b->out);
+  b->written += len;
+}
+
+// Writes zeros up to offset
+static void pad_to(struct GmmbBuilder *b, uint64 offset) {
+  static const uint8 zeros[GMMB_LAYER_ALIGN];
+  while (b->written < offset) {
+    uint64 len = offset - b->written;
+    put(b, zeros, len < sizeof(zeros) ? (size_t)len : sizeof(zeros));
+  }
+}
+
+RESULT write_gmmb(FILE *out, GmmChunkArray *chunks, GmmSession *session) {
+  if (session->error.code < 0)
+    return session->error.code;
+  struct GmmbBuilder b = {0};
+  b.out = out;
+  b.arena = &session->arena;
+  b.error = &session->error;
+  if (level_chunks_array_init_in(&b.levels, b.arena, 16) < 0 ||
+      string_array_init_in(&b.strings, b.arena, 256) < 0 ||
+      collect_chunks(&b, chunks, NULL) < 0) {
+    gmm_set_error(b.error, RES_OUT_OF_MEMORY, "Out of memory");
+    return RES_OUT_OF_MEMORY;
+  }
+
+  GmmbHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, GMMB_MAGIC, 4);
+  header.version = GMMB_VERSION;
+  header.num_levels = (uint32)b.levels.len;
+  header.num_links = b.links != NULL ? b.links->num_links : 0;
+  RiffChunkMapProperties no_prop = {0};
+  const RiffChunkMapProperties *prop =
+      b.map_prop != NULL ? b.map_prop : &no_prop;
+  header.map_version = prop->version;
+  if (b.map_coords != NULL) {
+    const RiffChunkMapCoords *c = b.map_coords;
+    copy_coords(&header.coords, c->origin, c->row_style, c->column_style,
+                c->row_start, c->column_start);
+  }
+  RESULT res;
+  if ((res = add_string(&b, prop->title, &header.title)) < 0 ||
+      (res = add_string(&b, prop->game, &header.game)) < 0 ||
+      (res = add_string(&b, prop->author, &header.author)) < 0 ||
+      (res = add_string(&b, prop->creation_time, &header.creation_time)) <
+          0 ||
+      (res = add_string(&b, prop->notes, &header.notes)) < 0)
+    return res;
+
+  GmmbLevel *levels =
+      arena_alloc(b.arena, header.num_levels * sizeof(GmmbLevel));
+  if (levels == NULL) {
+    gmm_set_error(b.error, RES_OUT_OF_MEMORY, "Out of memory");
+    return RES_OUT_OF_MEMORY;
+  }
+  memset(levels, 0, header.num_levels * sizeof(GmmbLevel));
+  for (uint32 i = 0; i < header.num_levels; ++i) {
+    if ((res = build_level(&b, &b.levels.data[i], &levels[i])) < 0)
+      return res;
+  }
+
+  // Layout: header, tables, strings and then the cell layers
+  uint64 offset = sizeof(GmmbHeader);
+  header.levels_offset = offset;
+  offset += header.num_levels * sizeof(GmmbLevel);
+  header.links_offset = offset;
+  offset = align_up(offset + header.num_links * sizeof(GmmbLink),
+                    GMMB_TABLE_ALIGN);
+  for (uint32 i = 0; i < header.num_levels; ++i) {
+    levels[i].annotations_offset = offset;
+    offset = align_up(offset + levels[i].num_annotations *
+                                   sizeof(GmmbAnnotation),
+                      GMMB_TABLE_ALIGN);
+    levels[i].regions_offset = offset;
+    offset += levels[i].num_regions * sizeof(GmmbRegion);
+  }
+  header.strings_offset = offset;
+  header.strings_size = b.strings_size;
+  offset += b.strings_size;
+  for (uint32 i = 0; i < header.num_levels; ++i) {
+    if (levels[i].num_cells == 0)
+      continue;
+    const struct LevelChunks *chunks = &b.levels.data[i];
+    for (int l = 0; l < GMMB_LAYER_COUNT; ++l) {
+      if (!(chunks->cell->layer_mask & GMM_LAYER_BIT(l)))
+        continue;
+      offset = align_up(offset, GMMB_LAYER_ALIGN);
+      levels[i].layers_offset[l] = offset;
+      offset += levels[i].num_cells;
+    }
+  }
+  header.file_size = offset;
+
+  put(&b, &header, sizeof(header));
+  put(&b, levels, header.num_levels * sizeof(GmmbLevel));
+  if (b.links != NULL)
+    put(&b, b.links->records, header.num_links * sizeof(GmmbLink));
+  for (uint32 i = 0; i < header.num_levels; ++i) {
+    struct LevelChunks *chunks = &b.levels.data[i];
+    pad_to(&b, levels[i].annotations_offset);
+    put(&b, chunks->annotations,
+        levels[i].num_annotations * sizeof(GmmbAnnotation));
+    pad_to(&b, levels[i].regions_offset);
+    put(&b, chunks->regions, levels[i].num_regions * sizeof(GmmbRegion));
+  }
+  for (size_t i = 0; i < b.strings.len; ++i) {
+    const GmmString *s = &b.strings.data[i];
+    put(&b, s->str, s->len);
+    put(&b, "", 1);
+  }
+  for (uint32 i = 0; i < header.num_levels; ++i) {
+    struct LevelChunks *chunks = &b.levels.data[i];
+    if (levels[i].num_cells == 0)
+      continue;
+    for (int l = 0; l < GMMB_LAYER_COUNT; ++l) {
+      if (levels[i].layers_offset[l] == 0)
+        continue;
+      const uint8 *layer = gmm_cell_layer(chunks->cell, l);
+      if (layer == NULL) {
+        gmm_set_error(b.error, RES_BAD_INPUT, "Couldn't decode cell layer %s",
+                      cell_layer_to_str(l));
+        return RES_BAD_INPUT;
+      }
+      pad_to(&b, levels[i].layers_offset[l]);
+      put(&b, layer, levels[i].num_cells);
+    }
+  }
+
+  if (fflush(out) != 0 || ferror(out)) {
+    gmm_set_error(b.error, RES_ERR, "Couldn't write the output");
+    return RES_ERR;
+  }
+  return RES_OK;
+}
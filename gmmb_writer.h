@@ -0,0 +1,35 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#ifndef GMMB_WRITER_H
+#define GMMB_WRITER_H
+
+#include <stdio.h>
+
+#include "gmm_file.h"
+
+// Writes the decoded chunks as a GMMB file (see gmmb.h). Every "lvl " LIST
+// becomes a level, in the order of the file. The strings and layers of the
+// chunks must still be valid, so with GMM_DECODE_STRING_VIEWS or
+// GMM_DECODE_LAZY_CELLS the RiffFile has to be kept until this returns.
+// Temporary tables are allocated from the session. Returns RES_OK or a
+// negative error code, the reason is recorded in session->error.
+RESULT write_gmmb(FILE *out, GmmChunkArray *chunks, GmmSession *session);
+
+#endif // GMMB_WRITER_H
@@ -0,0 +1,323 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "json_writer.h"
+
+// Escape character for every byte that can't appear in a JSON string as it
+// is, 'u' for the ones that are written as \u00XX. json-c escapes '/' too.
+static const char escapes[256] = {
+    ['\b'] = 'b', ['\t'] = 't', ['\n'] = 'n', ['\f'] = 'f', ['\r'] = 'r',
+    [0x00] = 'u', [0x01] = 'u', [0x02] = 'u', [0x03] = 'u', [0x04] = 'u',
+    [0x05] = 'u', [0x06] = 'u', [0x07] = 'u', [0x0b] = 'u', [0x0e] = 'u',
+    [0x0f] = 'u', [0x10] = 'u', [0x11] = 'u', [0x12] = 'u', [0x13] = 'u',
+    [0x14] = 'u', [0x15] = 'u', [0x16] = 'u', [0x17] = 'u', [0x18] = 'u',
+    [0x19] = 'u', [0x1a] = 'u', [0x1b] = 'u', [0x1c] = 'u', [0x1d] = 'u',
+    [0x1e] = 'u', [0x1f] = 'u', ['"'] = '"',  ['\\'] = '\\', ['/'] = '/',
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+void json_writer_init(JsonWriter *w, int fd) {
+  w->fd = fd;
+  w->len = 0;
+  w->error = RES_OK;
+  w->bytes_written = 0;
+  w->hash = NULL;
+  w->depth = 0;
+  w->after_key = false;
+  w->first[0] = true;
+}
+
+RESULT json_writer_flush(JsonWriter *w) {
+  if (w->hash != NULL)
+    xxh64_update(w->hash, w->buf, w->len);
+  w->bytes_written += w->len;
+  size_t done = 0;
+  while (done < w->len && w->error == RES_OK) {
+    ssize_t written = write(w->fd, w->buf + done, w->len - done);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      w->error = RES_ERR;
+    else
+      done += (size_t)written;
+  }
+  w->len = 0;
+  return w->error;
+}
+
+void json_raw(JsonWriter *w, const char *data, size_t len) {
+  while (len > 0) {
+    if (w->len == JSON_WRITER_BUFFER_SIZE)
+      json_writer_flush(w);
+    size_t room = JSON_WRITER_BUFFER_SIZE - w->len;
+    size_t take = len < room ? len : room;
+    memcpy(w->buf + w->len, data, take);
+    w->len += take;
+    data += take;
+    len -= take;
+  }
+}
+
+// Writes the separator that goes in front of the next value of an array.
+static void value_prefix(JsonWriter *w) {
+  if (w->after_key) {
+    w->after_key = false;
+    return;
+  }
+  if (w->depth == 0)
+    return;
+  if (w->first[w->depth]) {
+    w->first[w->depth] = false;
+    json_raw(w, " ", 1);
+  } else {
+    json_raw(w, ", ", 2);
+  }
+}
+
+static void begin_container(JsonWriter *w, char open) {
+  value_prefix(w);
+  json_raw(w, &open, 1);
+  // deeper levels are flattened into the last one, which only affects
+  // the commas of documents that nobody writes
+  if (w->depth < JSON_WRITER_MAX_DEPTH)
+    w->depth++;
+  w->first[w->depth] = true;
+}
+
+static void end_container(JsonWriter *w, const char *close) {
+  json_raw(w, close, 2);
+  if (w->depth > 0)
+    w->depth--;
+}
+
+void json_begin_object(JsonWriter *w) { begin_container(w, '{'); }
+
+void json_end_object(JsonWriter *w) { end_container(w, " }"); }
+
+void json_begin_array(JsonWriter *w) { begin_container(w, '['); }
+
+void json_end_array(JsonWriter *w) { end_container(w, " ]"); }
+
+void json_key(JsonWriter *w, const char *key) {
+  w->after_key = false;
+  value_prefix(w);
+  json_raw(w, "\"", 1);
+  json_raw(w, key, strlen(key));
+  json_raw(w, "\": ", 3);
+  w->after_key = true;
+}
+
+// Formats value into the digits that end at end, returns the first one.
+static char *format_uint(char *end, uint64_t value) {
+  do {
+    *--end = (char)('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  return end;
+}
+
+void json_uint(JsonWriter *w, uint64_t value) {
+  char digits[20];
+  char *end = digits + sizeof(digits);
+  char *start = format_uint(end, value);
+  value_prefix(w);
+  json_raw(w, start, (size_t)(end - start));
+}
+
+void json_int(JsonWriter *w, int64_t value) {
+  char digits[21];
+  char *end = digits + sizeof(digits);
+  uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+  char *start = format_uint(end, magnitude);
+  if (value < 0)
+    *--start = '-';
+  value_prefix(w);
+  json_raw(w, start, (size_t)(end - start));
+}
+
+void json_string(JsonWriter *w, const char *str, size_t len) {
+  value_prefix(w);
+  json_raw(w, "\"", 1);
+  size_t start = 0;
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = (unsigned char)str[i];
+    char escape = escapes[c];
+    if (escape == 0)
+      continue;
+    json_raw(w, str + start, i - start);
+    if (escape == 'u') {
+      char seq[6] = {'\\', 'u', '0', '0', hex_digits[c >> 4],
+                     hex_digits[c & 0xf]};
+      json_raw(w, seq, sizeof(seq));
+    } else {
+      char seq[2] = {'\\', escape};
+      json_raw(w, seq, sizeof(seq));
+    }
+    start = i + 1;
+  }
+  json_raw(w, str + start, len - start);
+  json_raw(w, "\"", 1);
+}
+
+// Array elements of the values 0-255, as the text ", 123" in the low bytes
+// and its length in the top byte. Every element is written with a single
+// 8-byte store, the bytes after the text are overwritten by the next one.
+static uint64_t uint8_elements[256];
+static pthread_once_t uint8_elements_once = PTHREAD_ONCE_INIT;
+
+static void init_uint8_elements(void) {
+  for (unsigned int v = 0; v < 256; ++v) {
+    char text[8] = {',', ' '};
+    char digits[3];
+    char *start = format_uint(digits + sizeof(digits), v);
+    size_t len = (size_t)(digits + sizeof(digits) - start);
+    memcpy(text + 2, start, len);
+    text[7] = (char)(len + 2);
+    memcpy(&uint8_elements[v], text, sizeof(text));
+  }
+}
+
+// Every element takes at most 8 bytes of buffer space, including the
+// bytes that are overwritten later
+#define ELEMENT_SPACE 8
+
+static inline char *put_uint8_element(char *dst, uint8_t value) {
+  uint64_t element = uint8_elements[value];
+  memcpy(dst, &element, sizeof(element));
+  return dst + ((const char *)&element)[7];
+}
+
+static inline char *put_uint16_element(char *dst, uint16_t value) {
+  if (value < 256)
+    return put_uint8_element(dst, (uint8_t)value);
+  char digits[5];
+  char *end = digits + sizeof(digits);
+  char *start = format_uint(end, value);
+  size_t len = (size_t)(end - start);
+  dst[0] = ',';
+  dst[1] = ' ';
+  memcpy(dst + 2, start, len);
+  return dst + 2 + len;
+}
+
+// Returns how many elements fit into the buffer, at most count. Flushes the
+// buffer when it is full.
+static size_t element_block(JsonWriter *w, size_t count) {
+  size_t room = (JSON_WRITER_BUFFER_SIZE - w->len) / ELEMENT_SPACE;
+  if (room == 0) {
+    json_writer_flush(w);
+    room = JSON_WRITER_BUFFER_SIZE / ELEMENT_SPACE;
+  }
+  return count < room ? count : room;
+}
+
+// Writes "[" and the first element, which gets no comma, only the space.
+static void begin_elements(JsonWriter *w, const char *first, const char *end) {
+  json_raw(w, "[", 1);
+  json_raw(w, first + 1, (size_t)(end - first - 1));
+}
+
+void json_uint8_array(JsonWriter *w, const uint8_t *values, size_t count) {
+  pthread_once(&uint8_elements_once, init_uint8_elements);
+  value_prefix(w);
+  if (count == 0) {
+    json_raw(w, "[ ]", 3);
+    return;
+  }
+  char first[ELEMENT_SPACE];
+  begin_elements(w, first, put_uint8_element(first, values[0]));
+  size_t i = 1;
+  while (i < count) {
+    // the whole block fits, so the loop needs no checks
+    size_t end = i + element_block(w, count - i);
+    char *dst = w->buf + w->len;
+    for (; i < end; ++i)
+      dst = put_uint8_element(dst, values[i]);
+    w->len = (size_t)(dst - w->buf);
+  }
+  json_raw(w, " ]", 2);
+}
+
+void json_uint16_array(JsonWriter *w, const uint16_t *values, size_t count) {
+  pthread_once(&uint8_elements_once, init_uint8_elements);
+  value_prefix(w);
+  if (count == 0) {
+    json_raw(w, "[ ]", 3);
+    return;
+  }
+  char first[ELEMENT_SPACE];
+  begin_elements(w, first, put_uint16_element(first, values[0]));
+  size_t i = 1;
+  while (i < count) {
+    size_t end = i + element_block(w, count - i);
+    char *dst = w->buf + w->len;
+    for (; i < end; ++i)
+      dst = put_uint16_element(dst, values[i]);
+    w->len = (size_t)(dst - w->buf);
+  }
+  json_raw(w, " ]", 2);
+}
+
+static const char base64_digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+void json_base64(JsonWriter *w, const uint8_t *data, size_t len) {
+  value_prefix(w);
+  json_raw(w, "\"", 1);
+  // whole groups of 3 bytes are encoded straight into the buffer
+  size_t groups = len / 3;
+  while (groups > 0) {
+    size_t room = (JSON_WRITER_BUFFER_SIZE - w->len) / 4;
+    if (room == 0) {
+      json_writer_flush(w);
+      continue;
+    }
+    size_t block = groups < room ? groups : room;
+    char *dst = w->buf + w->len;
+    for (size_t i = 0; i < block; ++i) {
+      uint32_t bits =
+          (uint32_t)data[0] << 16 | (uint32_t)data[1] << 8 | data[2];
+      dst[0] = base64_digits[bits >> 18];
+      dst[1] = base64_digits[(bits >> 12) & 0x3f];
+      dst[2] = base64_digits[(bits >> 6) & 0x3f];
+      dst[3] = base64_digits[bits & 0x3f];
+      data += 3;
+      dst += 4;
+    }
+    w->len = (size_t)(dst - w->buf);
+    groups -= block;
+  }
+  size_t rest = len % 3;
+  if (rest > 0) {
+    uint32_t bits = (uint32_t)data[0] << 16;
+    if (rest == 2)
+      bits |= (uint32_t)data[1] << 8;
+    char tail[4] = {base64_digits[bits >> 18],
+                    base64_digits[(bits >> 12) & 0x3f],
+                    rest == 2 ? base64_digits[(bits >> 6) & 0x3f] : '=', '='};
+    json_raw(w, tail, sizeof(tail));
+  }
+  json_raw(w, "\"", 1);
+}
@@ -0,0 +1,82 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "defs.h"
+#include "xxh64.h"
+
+// Streaming JSON serializer. Values are written straight into a fixed size
+// buffer that is flushed to a file descriptor whenever it fills up, so no
+// document tree is built and memory use doesn't depend on the output size.
+//
+// The output is formatted exactly like json-c's json_object_to_json_string:
+// { "key": value, "key2": value2 } and [ 1, 2 ], with "{ }" and "[ ]" for
+// empty containers and the same string escaping.
+#define JSON_WRITER_BUFFER_SIZE (64 * 1024)
+#define JSON_WRITER_MAX_DEPTH 32
+
+typedef struct JsonWriter {
+  int fd;
+  size_t len;   // bytes in buf
+  RESULT error; // first write error, further output is dropped after it
+  // output passed to fd so far
+  uint64_t bytes_written;
+  // if not NULL, updated with all output
+  Xxh64State *hash;
+  unsigned int depth;
+  bool after_key; // the next value belongs to a key that was just written
+  // first[d] is true while the container at depth d is empty
+  bool first[JSON_WRITER_MAX_DEPTH + 1];
+  char buf[JSON_WRITER_BUFFER_SIZE];
+} JsonWriter;
+
+// Starts a new document on fd. hash is cleared, set it after this to hash
+// the output.
+void json_writer_init(JsonWriter *w, int fd);
+// Writes out the buffered output. Returns the first error of the writer.
+RESULT json_writer_flush(JsonWriter *w);
+
+void json_begin_object(JsonWriter *w);
+void json_end_object(JsonWriter *w);
+void json_begin_array(JsonWriter *w);
+void json_end_array(JsonWriter *w);
+// Starts a member of the current object, the value has to follow.
+void json_key(JsonWriter *w, const char *key);
+
+void json_uint(JsonWriter *w, uint64_t value);
+void json_int(JsonWriter *w, int64_t value);
+// Writes len bytes of str as a JSON string. The bytes are not validated as
+// UTF-8, like in json-c.
+void json_string(JsonWriter *w, const char *str, size_t len);
+// Write whole arrays of small integers, like [ 1, 2 ], much faster than one
+// json_uint call per value.
+void json_uint8_array(JsonWriter *w, const uint8_t *values, size_t count);
+void json_uint16_array(JsonWriter *w, const uint16_t *values, size_t count);
+// Writes len bytes of data as a base64 string (RFC 4648, with padding).
+void json_base64(JsonWriter *w, const uint8_t *data, size_t len);
+// Copies bytes to the output as they are.
+void json_raw(JsonWriter *w, const char *data, size_t len);
+
+#endif // JSON_WRITER_H
@@ -18,171 +18,21 @@
    <https://www.gnu.org/licenses/>
 */
 #include <assert.h>
-#include <json-c/json_object.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "allocator.h"
+#include "batch.h"
+#include "convert.h"
 #include "defs.h"
 #include "dynarray.h"
 #include "gmm_file.h"
-
-#define JSOBJ_UINT(out, ck, prop)                                              \
-  json_object_object_add((out), #prop, json_object_new_uint64((ck).prop))
-#define JSOBJ_STR(out, ck, prop)                                               \
-  json_object_object_add((out), #prop, json_object_new_string((ck).prop))
-#define JSOBJ_INT(out, ck, prop)                                               \
-  json_object_object_add((out), #prop, json_object_new_int((ck).prop));
-#define JSOBJ_ARR(out, ck, type, prop, size)                                   \
-  {                                                                            \
-    json_object *new_array = json_object_new_array_ext(size);                  \
-    for (size_t i = 0; i < size; ++i) {                                        \
-      json_object_array_put_idx(new_array, i,                                  \
-                                json_object_new_##type(ck.prop[i]));           \
-    }                                                                          \
-    json_object_object_add((out), #prop, new_array);                           \
-  }
-
-json_object *export_gmm(GmmChunk *ck) {
-  json_object *result = json_object_new_object();
-  size_t cells_cnt = 0;
-  json_object_object_add(result, "chunk_type",
-                         json_object_new_string(chunk_type_to_str(ck->ctype)));
-
-  switch (ck->ctype) {
-  case GMM_LIST:
-    json_object_object_add(
-        result, "list_type",
-        json_object_new_string_len(ck->list_chunk.ckType, 4));
-    size_t child_count = dynarray_size(&ck->list_chunk.children);
-    json_object *child_array = json_object_new_array_ext(child_count);
-
-    for (size_t i = 0; i < child_count; ++i) {
-      GmmChunk *child = dynarray_get(&ck->list_chunk.children, i);
-      assert(child != NULL);
-
-      json_object_array_put_idx(child_array, i, export_gmm(child));
-    }
-    json_object_object_add(result, "children", child_array);
-    break;
-  case GMM_MAP_PROP:
-    JSOBJ_UINT(result, ck->map_prop_chunk, version);
-    JSOBJ_STR(result, ck->map_prop_chunk, title);
-    JSOBJ_STR(result, ck->map_prop_chunk, game);
-    JSOBJ_STR(result, ck->map_prop_chunk, author);
-    JSOBJ_STR(result, ck->map_prop_chunk, creation_time);
-    JSOBJ_STR(result, ck->map_prop_chunk, notes);
-    break;
-  case GMM_MAP_COOR:
-    JSOBJ_UINT(result, ck->map_coor_chunk, origin);
-    JSOBJ_UINT(result, ck->map_coor_chunk, row_style);
-    JSOBJ_UINT(result, ck->map_coor_chunk, column_style);
-    JSOBJ_UINT(result, ck->map_coor_chunk, row_start);
-    JSOBJ_UINT(result, ck->map_coor_chunk, column_start);
-    break;
-  case GMM_LVL_PROP:
-    JSOBJ_STR(result, ck->level_prop_chunk, location_name);
-    JSOBJ_STR(result, ck->level_prop_chunk, level_name);
-    JSOBJ_INT(result, ck->level_prop_chunk, elevation);
-    JSOBJ_UINT(result, ck->level_prop_chunk, num_rows);
-    JSOBJ_UINT(result, ck->level_prop_chunk, num_columns);
-    JSOBJ_UINT(result, ck->level_prop_chunk, override_coord_opts);
-    JSOBJ_STR(result, ck->level_prop_chunk, notes);
-    break;
-  case GMM_LVL_COOR:
-    JSOBJ_UINT(result, ck->level_coor_chunk, origin);
-    JSOBJ_UINT(result, ck->level_coor_chunk, row_style);
-    JSOBJ_UINT(result, ck->level_coor_chunk, column_style);
-    JSOBJ_UINT(result, ck->level_coor_chunk, row_start);
-    JSOBJ_UINT(result, ck->level_coor_chunk, column_start);
-    break;
-  case GMM_LVL_CELL:
-    cells_cnt = ck->level_cell_chunk.cells_count;
-    JSOBJ_ARR(result, ck->level_cell_chunk, uint64, floor, cells_cnt);
-    JSOBJ_ARR(result, ck->level_cell_chunk, uint64, floor_orientation,
-              cells_cnt);
-    JSOBJ_ARR(result, ck->level_cell_chunk, uint64, floor_color, cells_cnt);
-    JSOBJ_ARR(result, ck->level_cell_chunk, uint64, wall_north, cells_cnt);
-    JSOBJ_ARR(result, ck->level_cell_chunk, uint64, wall_west, cells_cnt);
-    JSOBJ_ARR(result, ck->level_cell_chunk, uint64, trail, cells_cnt);
-    break;
-  case GMM_LVL_ANNO:
-    JSOBJ_UINT(result, ck->level_anno_chunk, num_annotations);
-    size_t anno_count = ck->level_anno_chunk.num_annotations;
-    json_object *anno_array = json_object_new_array_ext(anno_count);
-    for (size_t i = 0; i < anno_count; ++i) {
-      AnnotationRecord *record = &ck->level_anno_chunk.records[i];
-      json_object *anno = json_object_new_object();
-      JSOBJ_UINT(anno, *record, row);
-      JSOBJ_UINT(anno, *record, column);
-      JSOBJ_UINT(anno, *record, kind);
-      JSOBJ_STR(anno, *record, text);
-      switch (record->kind) {
-      case AK_COMMENT:
-        break;
-      case AK_INDEXED:
-        JSOBJ_UINT(anno, record->indexed, index);
-        JSOBJ_UINT(anno, record->indexed, index_color);
-        break;
-      case AK_CUSTOM:
-        JSOBJ_STR(anno, record->custom, custom_id);
-        break;
-      case AK_ICON:
-        JSOBJ_UINT(anno, record->icon, icon);
-        break;
-      case AK_LABEL:
-        JSOBJ_UINT(anno, record->label, label_color);
-        break;
-      }
-      json_object_array_put_idx(anno_array, i, anno);
-    }
-    json_object_object_add(result, "records", anno_array);
-    break;
-  case GMM_LVL_REGN:
-    JSOBJ_UINT(result, ck->level_regn_chunk, enable_regions);
-    JSOBJ_UINT(result, ck->level_regn_chunk, rows_per_region);
-    JSOBJ_UINT(result, ck->level_regn_chunk, columns_per_region);
-    JSOBJ_UINT(result, ck->level_regn_chunk, per_region_coords);
-    JSOBJ_UINT(result, ck->level_regn_chunk, num_regions);
-    const size_t regn_count = ck->level_regn_chunk.num_regions;
-    json_object *regn_array = json_object_new_array_ext(regn_count);
-    for (size_t i = 0; i < regn_count; ++i) {
-      const LevelRegionRecord *record = &ck->level_regn_chunk.records[i];
-      json_object *regn = json_object_new_object();
-      JSOBJ_STR(regn, *record, name);
-      JSOBJ_STR(regn, *record, notes);
-      json_object_array_put_idx(regn_array, i, regn);
-    }
-    json_object_object_add(result, "records", regn_array);
-    break;
-  case GMM_MAP_LINKS:
-    JSOBJ_UINT(result, ck->map_links_chunk, num_links);
-    const size_t links_count = ck->map_links_chunk.num_links;
-    json_object *links_array = json_object_new_array_ext(links_count);
-    for (size_t i = 0; i < links_count; ++i) {
-      const MapLinksRecord *record = &ck->map_links_chunk.records[i];
-      json_object *link = json_object_new_object();
-      JSOBJ_UINT(link, *record, src_level_index);
-      JSOBJ_UINT(link, *record, src_row);
-      JSOBJ_UINT(link, *record, src_column);
-      JSOBJ_UINT(link, *record, dest_level_index);
-      JSOBJ_UINT(link, *record, dest_row);
-      JSOBJ_UINT(link, *record, dest_column);
-      json_object_array_put_idx(links_array, i, link);
-    }
-    json_object_object_add(result, "records", links_array);
-    break;
-  case GMM_UNKNOWN:
-    break;
-  }
-
-  return result;
-}
-
-#undef JSOBJ_STR
-#undef JSOBJ_UINT
-#undef JSOBJ_INT
-#undef JSOBJ_ARR
+#include "server.h"
+#include "threadpool.h"
+#include "trace.h"
+#include "watch.h"
 
 void print_chunk(GmmChunk *ck, unsigned int tabs) {
   for (unsigned int i = 0; i < tabs; ++i) {
@@ -200,59 +50,318 @@ void print_chunk(GmmChunk *ck, unsigned int tabs) {
     }
     strncpy(ck_type, (char *)ck->list_chunk.ckType, 4);
     printf("LIST chunk type: '%s'\n", ck_type);
-    for (unsigned int i = 0; i < dynarray_size(&ck->list_chunk.children); ++i) {
-      print_chunk((GmmChunk *)dynarray_get(&ck->list_chunk.children, i),
-                  tabs + 1);
+    for (size_t i = 0; i < ck->list_chunk.children.len; ++i) {
+      print_chunk(&ck->list_chunk.children.data[i], tabs + 1);
     }
   }
 }
 
-int main(int argc, char **argv) {
-  FILE *gmfile = NULL;
-  Context ctx;
-  RiffFile gmm_data;
+void print_usage(const char *program) {
+  printf("%s\n", "gmm2json is a to-json converter for Gridmonger .gmm files");
+  printf("Usage: %s [options] <file_name>\n", program);
+  printf("       %s [options] - (reads the file from stdin)\n", program);
+  printf("       %s [options] -b <dir> <files, directories or patterns>...\n",
+         program);
+  printf("       %s [-j <n>] --serve <socket>\n\n", program);
+  printf("Options:\n");
+  printf("  -j, --threads <n>  decode levels on n threads (default: number of "
+         "CPUs)\n");
+  printf("  -c, --cells <enc>  write cell layers as array (default), base64 "
+         "or rle\n");
+  printf("  -f, --format <fmt> write json (default) or gmmb, the binary "
+         "format\n");
+  printf("  -l, --levels <list>\n"
+         "                     only export the levels with these indices "
+         "or names,\n"
+         "                     separated by commas\n");
+  printf("  --layers <list>    only export these cell layers, for example "
+         "floor,wall_north\n");
+  printf("  -o, --output-dir <dir>\n"
+         "                     write every level to a JSON file of its own "
+         "in dir,\n"
+         "                     with a manifest.json for the whole map\n");
+  printf("  -w, --watch        with --output-dir, update the levels that "
+         "change whenever\n"
+         "                     the map is saved\n");
+  printf("  -b, --batch <dir>  convert all given maps into dir, in "
+         "parallel\n");
+  printf("  --cache <dir>      reuse the outputs of unchanged maps, which are "
+         "kept in dir\n");
+  printf("  --serve <socket>   convert the maps that clients ask for on a "
+         "Unix socket\n");
+  printf("  --connect <socket> let the server on socket convert the map\n");
+  printf("  --stats            print statistics of the conversion to "
+         "stderr\n");
+  printf("  --trace <file>     write a Chrome trace of the conversion, for "
+         "Perfetto\n");
+  printf("  --max-memory <mb>  fail instead of taking more than mb megabytes "
+         "for the\n"
+         "                     decoded maps\n\n");
+  printf("gmm2json Copyright (C) 2025 Jagholin.\n");
+  printf("This program comes with ABSOLUTELY NO WARRANTY.\n");
+  printf("This is free software, and you are welcome to redistribute it \n");
+  printf("under certain conditions. See COPYING and COPYING.LESSER for more "
+         "details\n");
+}
+
+// Converts a single map to stdout, or into output_dir
+static int convert_single(const char *file_name, const char *output_dir,
+                          const ConvertOptions *opts) {
+  GmmError error = {RES_OK, ""};
+  RESULT res;
+  if (output_dir != NULL) {
+    res = convert_shards(file_name, output_dir, opts, &error);
+  } else if (strcmp(file_name, "-") == 0 && opts->format == FORMAT_JSON &&
+             opts->selection == NULL && opts->cache == NULL &&
+             opts->trace == NULL && opts->allocator == NULL) {
+    res = convert_stream(STDIN_FILENO, "<stdin>", STDOUT_FILENO, opts, &error);
+  } else {
+    // GMMB output, selections, the cache, tracing and the memory budget need
+    // the whole file, stdin is read into memory for them
+    res = convert_file(file_name, NULL, opts, &error);
+  }
+  if (res < 0) {
+    fprintf(stderr, "%s\n", error.message);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
 
-  last_error = RES_OK;
+int main(int argc, char **argv) {
+  char **inputs = NULL;
+  size_t num_inputs = 0;
+  const char *output_dir = NULL;
+  const char *batch_dir = NULL;
+  unsigned int threads = threadpool_default_threads();
+  const char *cache_dir = NULL;
+  ConvertCache cache;
+  ConvertOptions opts = {CELLS_ARRAY, FORMAT_JSON, 1, NULL, NULL, NULL, NULL};
+  GmmSelection selection = {NULL, 0, NULL, 0, GMM_LAYERS_ALL};
+  bool watch = false;
+  char *level_list = NULL;
+  char *layer_list = NULL;
+  const char *cells_name = NULL;
+  const char *format_name = NULL;
+  const char *serve_socket = NULL;
+  const char *connect_socket = NULL;
+  bool stats = false;
+  const char *trace_file = NULL;
+  size_t max_memory = 0; // megabytes, 0 for no limit
+  GmmMemoryBudget budget;
 
   assert(sizeof(uint8) == 1);
   assert(sizeof(uint16) == 2);
   assert(sizeof(uint32) == 4);
-  if (argc != 2) {
-    printf("%s\n", "gmm2json is a to-json converter for Gridmonger .gmm files");
-    printf("Usage: %s <file_name>\n\n", argv[0]);
-    printf("gmm2json Copyright (C) 2025 Jagholin.\n");
-    printf("This program comes with ABSOLUTELY NO WARRANTY.\n");
-    printf("This is free software, and you are welcome to redistribute it \n");
-    printf("under certain conditions. See COPYING and COPYING.LESSER for more "
-           "details\n");
+  inputs = malloc((size_t)argc * sizeof(char *));
+  if (inputs == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return EXIT_FAILURE;
+  }
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--threads") == 0) {
+      char *end = NULL;
+      if (i + 1 == argc || (threads = strtoul(argv[++i], &end, 10)) == 0 ||
+          *end != '\0') {
+        printf("%s expects a positive number of threads\n", argv[i - 1]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--cells") == 0) {
+      cells_name = i + 1 < argc ? argv[++i] : "";
+      if (!convert_parse_cells(cells_name, &opts.cells)) {
+        printf("%s expects array, base64 or rle\n", argv[i - 1]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "-f") == 0 ||
+               strcmp(argv[i], "--format") == 0) {
+      format_name = i + 1 < argc ? argv[++i] : "";
+      if (!convert_parse_format(format_name, &opts.format)) {
+        printf("%s expects json or gmmb\n", argv[i - 1]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "-l") == 0 ||
+               strcmp(argv[i], "--levels") == 0) {
+      if (i + 1 == argc) {
+        printf("%s expects a list of level indices or names\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+      level_list = argv[++i];
+    } else if (strcmp(argv[i], "--layers") == 0) {
+      if (i + 1 == argc) {
+        printf("%s expects a list of cell layers\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+      layer_list = argv[++i];
+    } else if (strcmp(argv[i], "-o") == 0 ||
+               strcmp(argv[i], "--output-dir") == 0) {
+      if (i + 1 == argc) {
+        printf("%s expects a directory\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+      output_dir = argv[++i];
+    } else if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--batch") == 0) {
+      if (i + 1 == argc) {
+        printf("%s expects a directory\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+      batch_dir = argv[++i];
+    } else if (strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--watch") == 0) {
+      watch = true;
+    } else if (strcmp(argv[i], "--serve") == 0) {
+      if (i + 1 == argc) {
+        printf("%s expects the path of a socket\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+      serve_socket = argv[++i];
+    } else if (strcmp(argv[i], "--connect") == 0) {
+      if (i + 1 == argc) {
+        printf("%s expects the path of a socket\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+      connect_socket = argv[++i];
+    } else if (strcmp(argv[i], "--cache") == 0) {
+      if (i + 1 == argc) {
+        printf("%s expects a directory\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+      cache_dir = argv[++i];
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      stats = true;
+    } else if (strcmp(argv[i], "--trace") == 0) {
+      if (i + 1 == argc) {
+        printf("%s expects a file name\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+      trace_file = argv[++i];
+    } else if (strcmp(argv[i], "--max-memory") == 0) {
+      char *end = NULL;
+      if (i + 1 == argc || (max_memory = strtoul(argv[++i], &end, 10)) == 0 ||
+          *end != '\0' || max_memory > SIZE_MAX / 1000000) {
+        printf("%s expects a positive number of megabytes\n", argv[i - 1]);
+        return EXIT_FAILURE;
+      }
+    } else {
+      inputs[num_inputs++] = argv[i];
+    }
+  }
+  if ((stats || trace_file != NULL) &&
+      (watch || serve_socket != NULL || connect_socket != NULL)) {
+    printf("--stats and --trace don't work with --watch, --serve or "
+           "--connect\n");
+    free(inputs);
+    return EXIT_FAILURE;
+  }
+  if (max_memory > 0 && (serve_socket != NULL || connect_socket != NULL)) {
+    printf("--max-memory doesn't work with --serve or --connect\n");
+    free(inputs);
+    return EXIT_FAILURE;
+  }
+  if (serve_socket != NULL && num_inputs == 0) {
+    free(inputs);
+    return server_run(serve_socket, threads);
+  }
+  if (num_inputs == 0 || (batch_dir == NULL && num_inputs > 1)) {
+    print_usage(argv[0]);
+    free(inputs);
     return EXIT_SUCCESS;
   }
-  // printf("Opening file: %s\n", argv[1]);
-  gmfile = fopen(argv[1], "rb");
-  if (!gmfile) {
-    printf("Cannot open file %s\n", argv[1]);
+  if (output_dir != NULL && (opts.format != FORMAT_JSON || batch_dir)) {
+    printf("--output-dir only works with JSON output of a single map\n");
+    free(inputs);
+    return EXIT_FAILURE;
+  }
+  if (watch && (output_dir == NULL || level_list != NULL ||
+                strcmp(inputs[0], "-") == 0)) {
+    printf("--watch needs a map file and --output-dir, and exports all "
+           "levels\n");
+    free(inputs);
+    return EXIT_FAILURE;
+  }
+  if (output_dir != NULL && cache_dir != NULL) {
+    printf("--cache doesn't work with --output-dir\n");
+    free(inputs);
     return EXIT_FAILURE;
   }
-  ctx.file_name = argv[1];
-  gmm_data = read_riff(gmfile, &ctx);
-  // printf("Loaded GMM file with length: %u\n", gmm_data.length);
-  Dynarray chunks = decode_chunks(&gmm_data);
-  // Dynarray chunks = decode_chunks(&gmm_data, 0, 0, NULL);
-  // for (unsigned int i = 0; i < dynarray_size(&chunks); ++i) {
-  //   print_chunk((GmmChunk *)dynarray_get(&chunks, i), 0);
-  // }
+  int status = EXIT_FAILURE;
+  if (connect_socket != NULL) {
+    // the server resolves paths in its own working directory
+    char *path = realpath(inputs[0], NULL);
+    if (output_dir != NULL || batch_dir != NULL || cache_dir != NULL) {
+      printf("--connect converts a single map to stdout\n");
+    } else if (path == NULL) {
+      fprintf(stderr, "Cannot open file %s\n", inputs[0]);
+    } else {
+      ServerRequest request = {path, format_name, cells_name, level_list,
+                               layer_list};
+      status = server_request(connect_socket, &request, STDOUT_FILENO);
+    }
+    free(path);
+    goto done;
+  }
+  if (layer_list != NULL &&
+      (selection.layers = convert_parse_layers(layer_list)) == 0) {
+    printf("--layers expects a list of cell layers: floor, "
+           "floor_orientation, floor_color, wall_north, wall_west or "
+           "trail\n");
+    goto done;
+  }
+  if (level_list != NULL && !convert_parse_levels(level_list, &selection)) {
+    fprintf(stderr, "Out of memory\n");
+    goto done;
+  }
+  if (level_list != NULL || layer_list != NULL)
+    opts.selection = &selection;
+  if (cache_dir != NULL) {
+    GmmError error = {RES_OK, ""};
+    if (convert_cache_init(&cache, cache_dir, &error) < 0) {
+      fprintf(stderr, "%s\n", error.message);
+      goto done;
+    }
+    opts.cache = &cache;
+  }
+  if ((stats || trace_file != NULL) &&
+      (opts.trace = gmm_trace_create(trace_file != NULL)) == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    goto done;
+  }
+  // --stats reports the peak memory use, which the budget keeps track of
+  if (max_memory > 0 || stats) {
+    gmm_budget_init(&budget, NULL, max_memory * 1000000);
+    opts.allocator = &budget.allocator;
+  }
 
-  json_object *gmm_array = json_object_new_array_ext(dynarray_size(&chunks));
-  for (size_t i = 0; i < dynarray_size(&chunks); ++i) {
-    json_object *gmm_json = export_gmm(dynarray_get(&chunks, i));
-    json_object_array_put_idx(gmm_array, i, gmm_json);
+  if (batch_dir != NULL) {
+    status = convert_batch(inputs, num_inputs, batch_dir, &opts, threads);
+  } else if (watch) {
+    opts.threads = threads;
+    status = watch_shards(inputs[0], output_dir, &opts);
+  } else {
+    opts.threads = threads;
+    status = convert_single(inputs[0], output_dir, &opts);
+  }
+  if (opts.cache != NULL)
+    fprintf(stderr, "Cache: %zu hits, %zu misses\n", atomic_load(&cache.hits),
+            atomic_load(&cache.misses));
+  if (stats) {
+    gmm_trace_print_stats(opts.trace, stderr);
+    fprintf(stderr, "Peak memory: %.3f MB",
+            (double)atomic_load(&budget.peak) / 1e6);
+    if (max_memory > 0)
+      fprintf(stderr, " of %zu MB allowed, %zu allocations refused",
+              max_memory, atomic_load(&budget.refused));
+    fprintf(stderr, "\n");
+  }
+  if (trace_file != NULL) {
+    GmmError error = {RES_OK, ""};
+    if (gmm_trace_write_chrome(opts.trace, trace_file, &error) < 0) {
+      fprintf(stderr, "%s\n", error.message);
+      status = EXIT_FAILURE;
+    }
   }
-  const char *output = json_object_to_json_string(gmm_array);
-  printf("%s\n", output);
 
-  json_object_put(gmm_array);
-  free_chunks(&chunks);
-  free_gmmfile(&gmm_data);
-  fclose(gmfile);
-  return EXIT_SUCCESS;
+done:
+  gmm_trace_free(opts.trace);
+  free((void *)selection.level_indices);
+  free((void *)selection.level_names);
+  free(inputs);
+  return status;
 }
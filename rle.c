@@ -0,0 +1,166 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#include <string.h>
+
+#include "rle.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define RLE_X86 1
+#include <immintrin.h>
+#endif
+
+// Longest run a single run header can encode
+#define RLE_MAX_RUN 128
+
+// Decodes one byte at a time, checking every access. Used on its own on
+// non-x86 CPUs and for the tails of the vectorized decoders.
+static RESULT rle_decode_tail(unsigned char *dest, unsigned char *dest_end,
+                              const unsigned char *src,
+                              const unsigned char *src_end) {
+  while (src < src_end) {
+    unsigned char next_byte = *src++;
+    if (next_byte & 0x80) {
+      size_t repeat_len = (size_t)(next_byte & 0x7f) + 1;
+      if (src == src_end)
+        return RES_BAD_INPUT;
+      if ((size_t)(dest_end - dest) < repeat_len)
+        return RES_BUFFER_TOO_SMALL;
+      memset(dest, *src++, repeat_len);
+      dest += repeat_len;
+    } else {
+      if (dest == dest_end)
+        return RES_BUFFER_TOO_SMALL;
+      *dest++ = next_byte;
+    }
+  }
+  memset(dest, 0, (size_t)(dest_end - dest));
+  return RES_OK;
+}
+
+#ifdef RLE_X86
+// The vectorized decoders work on blocks. As long as a whole input vector
+// and the longest possible run plus one vector of output fit into the
+// buffers, no further bounds checks are needed. Stores past the decoded end
+// are fine, they are overwritten later or zeroed by the tail.
+
+__attribute__((target("sse2"))) static RESULT
+rle_decode_sse2(unsigned char *dest, unsigned char *dest_end,
+                const unsigned char *src, const unsigned char *src_end) {
+  while (src_end - src >= 16 && dest_end - dest >= RLE_MAX_RUN + 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)src);
+    unsigned int headers = (unsigned int)_mm_movemask_epi8(block);
+    // literals are stored as they are
+    _mm_storeu_si128((__m128i *)dest, block);
+    if (headers == 0) {
+      src += 16;
+      dest += 16;
+      continue;
+    }
+    unsigned int literals = (unsigned int)__builtin_ctz(headers);
+    src += literals;
+    dest += literals;
+    // src[0] is a run header, src[1] is inside of the block unless the
+    // header is its last byte
+    if (literals == 15 && src_end - src < 2)
+      break;
+    size_t repeat_len = (size_t)(src[0] & 0x7f) + 1;
+    __m128i value = _mm_set1_epi8((char)src[1]);
+    for (size_t i = 0; i < repeat_len; i += 16)
+      _mm_storeu_si128((__m128i *)(dest + i), value);
+    dest += repeat_len;
+    src += 2;
+  }
+  return rle_decode_tail(dest, dest_end, src, src_end);
+}
+
+__attribute__((target("avx2"))) static RESULT
+rle_decode_avx2(unsigned char *dest, unsigned char *dest_end,
+                const unsigned char *src, const unsigned char *src_end) {
+  while (src_end - src >= 32 && dest_end - dest >= RLE_MAX_RUN + 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)src);
+    unsigned int headers = (unsigned int)_mm256_movemask_epi8(block);
+    _mm256_storeu_si256((__m256i *)dest, block);
+    if (headers == 0) {
+      src += 32;
+      dest += 32;
+      continue;
+    }
+    unsigned int literals = (unsigned int)__builtin_ctz(headers);
+    src += literals;
+    dest += literals;
+    if (literals == 31 && src_end - src < 2)
+      break;
+    size_t repeat_len = (size_t)(src[0] & 0x7f) + 1;
+    __m256i value = _mm256_set1_epi8((char)src[1]);
+    for (size_t i = 0; i < repeat_len; i += 32)
+      _mm256_storeu_si256((__m256i *)(dest + i), value);
+    dest += repeat_len;
+    src += 2;
+  }
+  return rle_decode_tail(dest, dest_end, src, src_end);
+}
+#endif
+
+static RleImpl resolve_impl(RleImpl impl) {
+#ifdef RLE_X86
+  if (impl == RLE_IMPL_AUTO)
+    impl = __builtin_cpu_supports("avx2") ? RLE_IMPL_AVX2 : RLE_IMPL_SSE2;
+  if (impl == RLE_IMPL_AVX2 && !__builtin_cpu_supports("avx2"))
+    impl = RLE_IMPL_SSE2;
+  if (impl == RLE_IMPL_SSE2 && !__builtin_cpu_supports("sse2"))
+    impl = RLE_IMPL_SCALAR;
+  return impl;
+#else
+  (void)impl;
+  return RLE_IMPL_SCALAR;
+#endif
+}
+
+RESULT rle_decode_impl(RleImpl impl, unsigned char *dest, size_t dest_len,
+                       const unsigned char *src, size_t src_len) {
+  unsigned char *dest_end = dest + dest_len;
+  const unsigned char *src_end = src + src_len;
+  switch (resolve_impl(impl)) {
+#ifdef RLE_X86
+  case RLE_IMPL_AVX2:
+    return rle_decode_avx2(dest, dest_end, src, src_end);
+  case RLE_IMPL_SSE2:
+    return rle_decode_sse2(dest, dest_end, src, src_end);
+#endif
+  default:
+    return rle_decode_tail(dest, dest_end, src, src_end);
+  }
+}
+
+RESULT rle_decode(unsigned char *dest, size_t dest_len,
+                  const unsigned char *src, size_t src_len) {
+  return rle_decode_impl(RLE_IMPL_AUTO, dest, dest_len, src, src_len);
+}
+
+const char *rle_impl_name(RleImpl impl) {
+  switch (resolve_impl(impl)) {
+  case RLE_IMPL_AVX2:
+    return "avx2";
+  case RLE_IMPL_SSE2:
+    return "sse2";
+  default:
+    return "scalar";
+  }
+}
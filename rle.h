@@ -0,0 +1,49 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#ifndef RLE_H
+#define RLE_H
+
+#include <stddef.h>
+
+#include "defs.h"
+
+// Decoder for the RLE compression of cell layers (compression_type 1).
+// A byte with the high bit clear is a literal. A byte with the high bit set
+// starts a run of ((byte & 0x7f) + 1) copies of the byte that follows.
+
+typedef enum RleImpl {
+  RLE_IMPL_AUTO = 0, // best implementation the CPU supports
+  RLE_IMPL_SCALAR,
+  RLE_IMPL_SSE2,
+  RLE_IMPL_AVX2,
+} RleImpl;
+
+// Expands src into dest. Cells that the stream doesn't cover are set to 0.
+// Returns RES_BUFFER_TOO_SMALL if the stream expands to more than dest_len
+// bytes and RES_BAD_INPUT if it ends in the middle of a run.
+RESULT rle_decode(unsigned char *dest, size_t dest_len,
+                  const unsigned char *src, size_t src_len);
+// Same, but with a specific implementation. Falls back to the scalar decoder
+// if the CPU doesn't support impl.
+RESULT rle_decode_impl(RleImpl impl, unsigned char *dest, size_t dest_len,
+                       const unsigned char *src, size_t src_len);
+const char *rle_impl_name(RleImpl impl);
+
+#endif // RLE_H
@@ -0,0 +1,514 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "convert.h"
+#include "server.h"
+#include "threadpool.h"
+
+// Decoded maps that are kept for later requests
+#define SERVER_CACHED_MAPS 8
+// Longest request that is accepted
+#define SERVER_MAX_REQUEST 8192
+
+enum RequestField {
+  REQUEST_PATH = 0,
+  REQUEST_FORMAT,
+  REQUEST_CELLS,
+  REQUEST_LEVELS,
+  REQUEST_LAYERS,
+  REQUEST_FIELD_COUNT,
+};
+
+static const char *const request_fields[REQUEST_FIELD_COUNT] = {
+    "path", "format", "cells", "levels", "layers"};
+
+// A decoded map. The file is compared with it on every request, so a map
+// that was saved since is decoded again.
+struct CachedMap {
+  char *key; // path and the options that change the decoding
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  LoadedMap *map;
+  pthread_mutex_t write_lock; // one request at a time writes the map
+  unsigned int refs;          // requests that use the map
+  uint64_t last_used;
+  bool cached; // if false, the last request frees the map
+};
+
+struct Server {
+  pthread_mutex_t lock; // of the cache
+  struct CachedMap *maps[SERVER_CACHED_MAPS];
+  uint64_t clock; // counts the cache lookups, to find the least recent map
+};
+
+struct Connection {
+  struct Server *server;
+  int fd;
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static bool write_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t written = write(fd, data, len);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += written;
+    len -= (size_t)written;
+  }
+  return true;
+}
+
+static void free_cached(struct CachedMap *cached) {
+  convert_free(cached->map);
+  pthread_mutex_destroy(&cached->write_lock);
+  free(cached->key);
+  free(cached);
+}
+
+static bool same_file(const struct CachedMap *cached, const struct stat *st) {
+  return cached->dev == st->st_dev && cached->ino == st->st_ino &&
+         cached->size == st->st_size &&
+         cached->mtime.tv_sec == st->st_mtim.tv_sec &&
+         cached->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// Removes the map in slot from the cache. Called with the cache locked.
+static void uncache(struct Server *server, size_t slot) {
+  struct CachedMap *cached = server->maps[slot];
+  server->maps[slot] = NULL;
+  cached->cached = false;
+  if (cached->refs == 0)
+    free_cached(cached);
+}
+
+// Returns the cached map for key, if the file is still the same, and takes
+// a reference to it.
+static struct CachedMap *cache_acquire(struct Server *server, const char *key,
+                                       const struct stat *st) {
+  struct CachedMap *found = NULL;
+  pthread_mutex_lock(&server->lock);
+  server->clock++;
+  for (size_t i = 0; i < SERVER_CACHED_MAPS; ++i) {
+    struct CachedMap *cached = server->maps[i];
+    if (cached == NULL || strcmp(cached->key, key) != 0)
+      continue;
+    if (same_file(cached, st)) {
+      found = cached;
+      found->refs++;
+      found->last_used = server->clock;
+    } else {
+      uncache(server, i);
+    }
+    break;
+  }
+  pthread_mutex_unlock(&server->lock);
+  return found;
+}
+
+// Adds a map that the caller holds a reference to. It replaces a map with
+// the same key, wherever it is, so a key is never cached twice. Otherwise it
+// takes an empty slot, or replaces the least recently used map that isn't in
+// use. If all maps are in use, the new map isn't cached.
+static void cache_insert(struct Server *server, struct CachedMap *cached) {
+  pthread_mutex_lock(&server->lock);
+  size_t same = SERVER_CACHED_MAPS;
+  size_t empty = SERVER_CACHED_MAPS;
+  size_t oldest = SERVER_CACHED_MAPS;
+  for (size_t i = 0; i < SERVER_CACHED_MAPS; ++i) {
+    struct CachedMap *other = server->maps[i];
+    if (other == NULL) {
+      if (empty == SERVER_CACHED_MAPS)
+        empty = i;
+    } else if (strcmp(other->key, cached->key) == 0) {
+      same = i;
+      break;
+    } else if (other->refs == 0 &&
+               (oldest == SERVER_CACHED_MAPS ||
+                other->last_used < server->maps[oldest]->last_used)) {
+      oldest = i;
+    }
+  }
+  size_t slot = same < SERVER_CACHED_MAPS    ? same
+                : empty < SERVER_CACHED_MAPS ? empty
+                                             : oldest;
+  if (slot < SERVER_CACHED_MAPS) {
+    if (server->maps[slot] != NULL)
+      uncache(server, slot);
+    server->maps[slot] = cached;
+    cached->cached = true;
+    cached->last_used = server->clock;
+  }
+  pthread_mutex_unlock(&server->lock);
+}
+
+static void cache_release(struct Server *server, struct CachedMap *cached) {
+  pthread_mutex_lock(&server->lock);
+  bool unused = --cached->refs == 0 && !cached->cached;
+  pthread_mutex_unlock(&server->lock);
+  if (unused)
+    free_cached(cached);
+}
+
+// Reads a request into buffer and points values at its fields. Returns
+// false if the request is malformed.
+static bool read_request(int fd, char *buffer, size_t size, char **values,
+                         GmmError *error) {
+  size_t len = 0;
+  char *end = NULL;
+  while (end == NULL) {
+    if (len + 1 == size) {
+      gmm_set_error(error, RES_BAD_INPUT, "The request is too long");
+      return false;
+    }
+    ssize_t got = read(fd, buffer + len, size - 1 - len);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0) {
+      gmm_set_error(error, RES_BAD_INPUT, "The request is incomplete");
+      return false;
+    }
+    len += (size_t)got;
+    buffer[len] = '\0';
+    end = strstr(buffer, "\n\n");
+  }
+  end[1] = '\0';
+  char *state = NULL;
+  for (char *line = strtok_r(buffer, "\n", &state); line != NULL;
+       line = strtok_r(NULL, "\n", &state)) {
+    char *value = strchr(line, ' ');
+    if (value != NULL)
+      *value++ = '\0';
+    int field = 0;
+    while (field < REQUEST_FIELD_COUNT &&
+           strcmp(line, request_fields[field]) != 0)
+      ++field;
+    if (field == REQUEST_FIELD_COUNT || value == NULL) {
+      gmm_set_error(error, RES_BAD_INPUT, "Unknown request line \"%s\"",
+                    line);
+      return false;
+    }
+    values[field] = value;
+  }
+  if (values[REQUEST_PATH] == NULL) {
+    gmm_set_error(error, RES_BAD_INPUT, "The request has no path");
+    return false;
+  }
+  return true;
+}
+
+// Sets up opts from the request. The key of the decoded map is built
+// first, parsing the selection modifies the values.
+static bool parse_options(char **values, ConvertOptions *opts,
+                          GmmSelection *selection, char **key,
+                          GmmError *error) {
+  const char *levels = values[REQUEST_LEVELS] ? values[REQUEST_LEVELS] : "";
+  const char *layers = values[REQUEST_LAYERS] ? values[REQUEST_LAYERS] : "";
+  size_t key_size = strlen(values[REQUEST_PATH]) + strlen(levels) +
+                    strlen(layers) + 3;
+  *key = malloc(key_size);
+  if (*key == NULL) {
+    gmm_set_error(error, RES_OUT_OF_MEMORY, "Out of memory");
+    return false;
+  }
+  snprintf(*key, key_size, "%s\n%s\n%s", values[REQUEST_PATH], levels,
+           layers);
+
+  if (values[REQUEST_FORMAT] != NULL &&
+      !convert_parse_format(values[REQUEST_FORMAT], &opts->format)) {
+    gmm_set_error(error, RES_BAD_INPUT, "format expects json or gmmb");
+    return false;
+  }
+  if (values[REQUEST_CELLS] != NULL &&
+      !convert_parse_cells(values[REQUEST_CELLS], &opts->cells)) {
+    gmm_set_error(error, RES_BAD_INPUT, "cells expects array, base64 or rle");
+    return false;
+  }
+  if (values[REQUEST_LAYERS] != NULL &&
+      (selection->layers = convert_parse_layers(values[REQUEST_LAYERS])) ==
+          0) {
+    gmm_set_error(error, RES_BAD_INPUT, "layers has an unknown cell layer");
+    return false;
+  }
+  if (values[REQUEST_LEVELS] != NULL &&
+      !convert_parse_levels(values[REQUEST_LEVELS], selection)) {
+    gmm_set_error(error, RES_OUT_OF_MEMORY, "Out of memory");
+    return false;
+  }
+  if (values[REQUEST_LEVELS] != NULL || values[REQUEST_LAYERS] != NULL)
+    opts->selection = selection;
+  return true;
+}
+
+// Takes the map from the cache, or decodes it and adds it to the cache
+static struct CachedMap *get_map(struct Server *server, const char *path,
+                                 char *key, const ConvertOptions *opts,
+                                 bool *hit, GmmError *error) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    gmm_set_error(error, RES_ERR, "Cannot open file %s", path);
+    return NULL;
+  }
+  struct CachedMap *cached = cache_acquire(server, key, &st);
+  *hit = cached != NULL;
+  if (cached != NULL)
+    return cached;
+  LoadedMap *map = convert_load(path, opts, error);
+  if (map == NULL)
+    return NULL;
+  cached = calloc(1, sizeof(struct CachedMap));
+  if (cached == NULL) {
+    gmm_set_error(error, RES_OUT_OF_MEMORY, "Out of memory");
+    convert_free(map);
+    return NULL;
+  }
+  cached->key = key;
+  cached->dev = st.st_dev;
+  cached->ino = st.st_ino;
+  cached->size = st.st_size;
+  cached->mtime = st.st_mtim;
+  cached->map = map;
+  cached->refs = 1;
+  pthread_mutex_init(&cached->write_lock, NULL);
+  cache_insert(server, cached);
+  return cached;
+}
+
+static void serve_connection(void *arg) {
+  struct Connection *conn = arg;
+  double start = now();
+  char request[SERVER_MAX_REQUEST];
+  char *values[REQUEST_FIELD_COUNT] = {NULL};
+  char *key = NULL;
+  ConvertOptions opts = {CELLS_ARRAY, FORMAT_JSON, 1, NULL, NULL, NULL, NULL};
+  GmmSelection selection = {NULL, 0, NULL, 0, GMM_LAYERS_ALL};
+  GmmError error = {RES_OK, ""};
+  struct CachedMap *cached = NULL;
+  bool hit = false;
+
+  if (read_request(conn->fd, request, sizeof(request), values, &error) &&
+      parse_options(values, &opts, &selection, &key, &error))
+    cached =
+        get_map(conn->server, values[REQUEST_PATH], key, &opts, &hit, &error);
+  if (cached == NULL) {
+    char reply[GMM_ERROR_MESSAGE_SIZE + 8];
+    snprintf(reply, sizeof(reply), "error %s\n", error.message);
+    write_all(conn->fd, reply, strlen(reply));
+    fprintf(stderr, "failed %s: %s\n",
+            values[REQUEST_PATH] ? values[REQUEST_PATH] : "request",
+            error.message);
+    goto done;
+  }
+  // the cached map owns the key now
+  if (cached->key == key)
+    key = NULL;
+
+  if (write_all(conn->fd, "ok\n", 3)) {
+    pthread_mutex_lock(&cached->write_lock);
+    convert_write(cached->map, conn->fd, &opts, &error);
+    pthread_mutex_unlock(&cached->write_lock);
+  } else {
+    gmm_set_error(&error, RES_ERR, "Couldn't write the output");
+  }
+  cache_release(conn->server, cached);
+  if (error.code < 0)
+    fprintf(stderr, "failed %s: %s\n", values[REQUEST_PATH], error.message);
+  else
+    fprintf(stderr, "served %s (%s, %.1f ms)\n", values[REQUEST_PATH],
+            hit ? "cached" : "decoded", (now() - start) * 1000);
+
+done:
+  free(key);
+  free((void *)selection.level_indices);
+  free((void *)selection.level_names);
+  close(conn->fd);
+  free(conn);
+}
+
+// Creates the socket. A socket that an earlier server left behind is
+// replaced, other files aren't touched.
+static int listen_on(const char *socket_path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "The socket path %s is too long\n", socket_path);
+    return -1;
+  }
+  strcpy(addr.sun_path, socket_path);
+  struct stat st;
+  if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(socket_path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "Couldn't listen on %s: %s\n", socket_path,
+            strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int server_run(const char *socket_path, unsigned int threads) {
+  struct Server server;
+  memset(&server, 0, sizeof(server));
+  pthread_mutex_init(&server.lock, NULL);
+  // a client that hangs up must not stop the server
+  signal(SIGPIPE, SIG_IGN);
+  int fd = listen_on(socket_path);
+  if (fd < 0)
+    return EXIT_FAILURE;
+  // The workers stay around between requests, every request is converted
+  // on one of them
+  ThreadPool *pool = threadpool_create(threads);
+  if (pool == NULL) {
+    fprintf(stderr, "Couldn't start the conversion threads\n");
+    close(fd);
+    return EXIT_FAILURE;
+  }
+  fprintf(stderr, "Listening on %s\n", socket_path);
+  while (true) {
+    int client = accept(fd, NULL, NULL);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      fprintf(stderr, "Couldn't accept connections: %s\n", strerror(errno));
+      break;
+    }
+    struct Connection *conn = malloc(sizeof(struct Connection));
+    if (conn != NULL) {
+      conn->server = &server;
+      conn->fd = client;
+    }
+    if (conn == NULL || threadpool_submit(pool, serve_connection, conn) < 0) {
+      close(client);
+      free(conn);
+    }
+  }
+  threadpool_destroy(pool);
+  close(fd);
+  for (size_t i = 0; i < SERVER_CACHED_MAPS; ++i) {
+    if (server.maps[i] != NULL)
+      free_cached(server.maps[i]);
+  }
+  pthread_mutex_destroy(&server.lock);
+  return EXIT_FAILURE;
+}
+
+int server_request(const char *socket_path, const ServerRequest *request,
+                   int out_fd) {
+  const char *values[REQUEST_FIELD_COUNT] = {
+      request->path, request->format, request->cells, request->levels,
+      request->layers};
+  char buffer[JSON_WRITER_BUFFER_SIZE];
+  size_t len = 0;
+  for (int i = 0; i < REQUEST_FIELD_COUNT; ++i) {
+    if (values[i] == NULL)
+      continue;
+    if (strchr(values[i], '\n') != NULL) {
+      fprintf(stderr, "The %s can't contain line breaks\n", request_fields[i]);
+      return EXIT_FAILURE;
+    }
+    len += (size_t)snprintf(buffer + len, sizeof(buffer) - len, "%s %s\n",
+                            request_fields[i], values[i]);
+    if (len >= SERVER_MAX_REQUEST) {
+      fprintf(stderr, "The request is too long\n");
+      return EXIT_FAILURE;
+    }
+  }
+  buffer[len++] = '\n';
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      !write_all(fd, buffer, len)) {
+    fprintf(stderr, "Couldn't connect to %s: %s\n", socket_path,
+            strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return EXIT_FAILURE;
+  }
+
+  // The status line, the output may follow right behind it
+  int status = EXIT_FAILURE;
+  char *line_end = NULL;
+  len = 0;
+  while (line_end == NULL && len + 1 < sizeof(buffer)) {
+    ssize_t got = read(fd, buffer + len, sizeof(buffer) - 1 - len);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      break;
+    len += (size_t)got;
+    buffer[len] = '\0';
+    line_end = memchr(buffer, '\n', len);
+  }
+  if (line_end == NULL) {
+    fprintf(stderr, "The server at %s didn't answer\n", socket_path);
+  } else if (strncmp(buffer, "ok\n", 3) != 0) {
+    *line_end = '\0';
+    fprintf(stderr, "%s\n",
+            strncmp(buffer, "error ", 6) == 0 ? buffer + 6 : buffer);
+  } else {
+    size_t rest = len - 3;
+    bool ok = write_all(out_fd, buffer + 3, rest);
+    ssize_t got;
+    while (ok && (got = read(fd, buffer, sizeof(buffer))) != 0) {
+      if (got < 0) {
+        ok = errno == EINTR;
+        continue;
+      }
+      ok = write_all(out_fd, buffer, (size_t)got);
+    }
+    if (ok)
+      status = EXIT_SUCCESS;
+    else
+      fprintf(stderr, "Couldn't receive the map from %s\n", socket_path);
+  }
+  close(fd);
+  return status;
+}
@@ -0,0 +1,57 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#ifndef SERVER_H
+#define SERVER_H
+
+// Conversion server on a Unix domain socket. Every connection carries one
+// request, a few "name value" lines that end with an empty line:
+//
+//   path /home/me/maps/castle.gmm
+//   format json
+//   cells base64
+//   levels 0,Cellar
+//   layers floor,wall_north
+//
+// Only path is required, the other lines take the values of the gmm2json
+// options of the same name. The server answers with "ok" or "error
+// <message>" on a line of its own. After "ok" the converted map follows
+// until the connection is closed; a JSON document that is cut short means
+// the conversion failed on the way.
+
+// Options of a request. NULL fields are left out of it.
+typedef struct ServerRequest {
+  const char *path; // absolute, the server has a working directory of its own
+  const char *format;
+  const char *cells;
+  const char *levels;
+  const char *layers;
+} ServerRequest;
+
+// Serves requests on socket_path with the given number of worker threads,
+// until the process is stopped. Recently used maps are kept decoded in
+// memory. Returns EXIT_FAILURE if the socket can't be created.
+int server_run(const char *socket_path, unsigned int threads);
+// Sends the request to the server at socket_path and copies the converted
+// map to out_fd. Errors are printed to stderr. Returns EXIT_SUCCESS if the
+// map was converted.
+int server_request(const char *socket_path, const ServerRequest *request,
+                   int out_fd);
+
+#endif // SERVER_H
@@ -0,0 +1,242 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "threadpool.h"
+
+struct PoolTask {
+  ThreadPoolTask task;
+  void *arg;
+  struct PoolTask *prev; // older task
+  struct PoolTask *next; // newer task
+};
+
+// Tasks of one worker. The worker takes its newest task, idle workers steal
+// the oldest one, so they rarely meet at the same end.
+struct WorkQueue {
+  pthread_mutex_t lock;
+  struct PoolTask *oldest;
+  struct PoolTask *newest;
+};
+
+struct Worker {
+  ThreadPool *pool;
+  unsigned int index; // of the worker's queue
+};
+
+struct ThreadPool {
+  struct WorkQueue *queues; // one per worker
+  struct Worker *workers;
+  pthread_t *threads;
+  // Every queue is drained by stealing even if its worker failed to start
+  unsigned int num_queues;
+  unsigned int num_threads; // started workers
+  atomic_uint next_queue; // for tasks that are submitted from other threads
+  atomic_size_t queued;   // tasks in the queues
+  atomic_size_t pending;  // queued and running tasks
+  // Only used to sleep when there is no work, the queues have own locks
+  pthread_mutex_t lock;
+  pthread_cond_t has_work; // signalled when a task is queued or on shutdown
+  pthread_cond_t idle;     // signalled when the last pending task finishes
+  bool shutdown;
+};
+
+// The worker that runs on this thread, tasks it submits stay in its queue
+static _Thread_local struct Worker *current_worker;
+
+static void push_newest(struct WorkQueue *queue, struct PoolTask *task) {
+  pthread_mutex_lock(&queue->lock);
+  task->next = NULL;
+  task->prev = queue->newest;
+  if (queue->newest != NULL)
+    queue->newest->next = task;
+  else
+    queue->oldest = task;
+  queue->newest = task;
+  pthread_mutex_unlock(&queue->lock);
+}
+
+static struct PoolTask *take_newest(struct WorkQueue *queue) {
+  pthread_mutex_lock(&queue->lock);
+  struct PoolTask *task = queue->newest;
+  if (task != NULL) {
+    queue->newest = task->prev;
+    if (queue->newest != NULL)
+      queue->newest->next = NULL;
+    else
+      queue->oldest = NULL;
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return task;
+}
+
+static struct PoolTask *take_oldest(struct WorkQueue *queue) {
+  pthread_mutex_lock(&queue->lock);
+  struct PoolTask *task = queue->oldest;
+  if (task != NULL) {
+    queue->oldest = task->next;
+    if (queue->oldest != NULL)
+      queue->oldest->prev = NULL;
+    else
+      queue->newest = NULL;
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return task;
+}
+
+// Takes a task from the worker's own queue, or steals one from the others.
+static struct PoolTask *find_task(ThreadPool *pool, unsigned int self) {
+  struct PoolTask *task = take_newest(&pool->queues[self]);
+  for (unsigned int i = 1; task == NULL && i < pool->num_queues; ++i)
+    task = take_oldest(&pool->queues[(self + i) % pool->num_queues]);
+  if (task != NULL)
+    atomic_fetch_sub(&pool->queued, 1);
+  return task;
+}
+
+static void *worker_main(void *arg) {
+  struct Worker *worker = arg;
+  ThreadPool *pool = worker->pool;
+  current_worker = worker;
+  while (true) {
+    struct PoolTask *task = find_task(pool, worker->index);
+    if (task == NULL) {
+      pthread_mutex_lock(&pool->lock);
+      while (atomic_load(&pool->queued) == 0 && !pool->shutdown)
+        pthread_cond_wait(&pool->has_work, &pool->lock);
+      bool stop = pool->shutdown && atomic_load(&pool->queued) == 0;
+      pthread_mutex_unlock(&pool->lock);
+      if (stop)
+        break;
+      continue;
+    }
+
+    task->task(task->arg);
+    free(task);
+
+    if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+      pthread_mutex_lock(&pool->lock);
+      pthread_cond_broadcast(&pool->idle);
+      pthread_mutex_unlock(&pool->lock);
+    }
+  }
+  current_worker = NULL;
+  return NULL;
+}
+
+ThreadPool *threadpool_create(unsigned int threads) {
+  if (threads == 0)
+    threads = 1;
+  ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+  if (pool == NULL)
+    return NULL;
+  pool->threads = calloc(threads, sizeof(pthread_t));
+  pool->queues = calloc(threads, sizeof(struct WorkQueue));
+  pool->workers = calloc(threads, sizeof(struct Worker));
+  if (pool->threads == NULL || pool->queues == NULL || pool->workers == NULL) {
+    free(pool->threads);
+    free(pool->queues);
+    free(pool->workers);
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->has_work, NULL);
+  pthread_cond_init(&pool->idle, NULL);
+  pool->num_queues = threads;
+  for (unsigned int i = 0; i < threads; ++i) {
+    pthread_mutex_init(&pool->queues[i].lock, NULL);
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+  }
+  for (unsigned int i = 0; i < threads; ++i) {
+    if (pthread_create(&pool->threads[i], NULL, worker_main,
+                       &pool->workers[i]) != 0)
+      break;
+    pool->num_threads++;
+  }
+  if (pool->num_threads == 0) {
+    threadpool_destroy(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+RESULT threadpool_submit(ThreadPool *pool, ThreadPoolTask task, void *arg) {
+  struct PoolTask *new_task = malloc(sizeof(struct PoolTask));
+  if (new_task == NULL)
+    return RES_ERR;
+  new_task->task = task;
+  new_task->arg = arg;
+
+  unsigned int queue;
+  if (current_worker != NULL && current_worker->pool == pool)
+    queue = current_worker->index;
+  else
+    queue = atomic_fetch_add(&pool->next_queue, 1) % pool->num_queues;
+  atomic_fetch_add(&pool->pending, 1);
+  // Counted before it is published, so a worker that takes the task at once
+  // can't decrement queued below 0. Until the push, workers may only look
+  // for it in vain.
+  atomic_fetch_add(&pool->queued, 1);
+  push_newest(&pool->queues[queue], new_task);
+  // taking the lock makes sure a worker that is about to sleep sees the task
+  pthread_mutex_lock(&pool->lock);
+  pthread_cond_signal(&pool->has_work);
+  pthread_mutex_unlock(&pool->lock);
+  return RES_OK;
+}
+
+void threadpool_wait(ThreadPool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  while (atomic_load(&pool->pending) > 0)
+    pthread_cond_wait(&pool->idle, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void threadpool_destroy(ThreadPool *pool) {
+  if (pool == NULL)
+    return;
+  threadpool_wait(pool);
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = true;
+  pthread_cond_broadcast(&pool->has_work);
+  pthread_mutex_unlock(&pool->lock);
+  for (unsigned int i = 0; i < pool->num_threads; ++i)
+    pthread_join(pool->threads[i], NULL);
+  for (unsigned int i = 0; i < pool->num_queues; ++i)
+    pthread_mutex_destroy(&pool->queues[i].lock);
+  pthread_cond_destroy(&pool->idle);
+  pthread_cond_destroy(&pool->has_work);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->queues);
+  free(pool->workers);
+  free(pool->threads);
+  free(pool);
+}
+
+unsigned int threadpool_default_threads(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? (unsigned int)cpus : 1;
+}
@@ -0,0 +1,43 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include "defs.h"
+
+typedef void (*ThreadPoolTask)(void *arg);
+
+// Work stealing thread pool. Every worker has a queue of its own: tasks
+// submitted by a task go to the queue of its worker, other tasks are spread
+// over the queues. Workers without work steal from the others.
+typedef struct ThreadPool ThreadPool;
+
+// Starts a pool with the given number of worker threads. Returns NULL if the
+// threads can't be created.
+ThreadPool *threadpool_create(unsigned int threads);
+RESULT threadpool_submit(ThreadPool *pool, ThreadPoolTask task, void *arg);
+// Blocks until all tasks submitted so far have finished.
+void threadpool_wait(ThreadPool *pool);
+// Waits for the queued tasks, then stops the workers.
+void threadpool_destroy(ThreadPool *pool);
+// Number of CPUs available to the process.
+unsigned int threadpool_default_threads(void);
+
+#endif // THREADPOOL_H
@@ -0,0 +1,659 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+// gmm2json_bench times the stages of a conversion separately: reading the
+// file, decoding the chunks, writing JSON and GMMB, and the whole
+// convert_file. Micro benchmarks on built-in data cover the cell layer and
+// string decoders and every RLE implementation. Results are printed as one
+// JSON object per line, see README.md.
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "convert.h"
+#include "gmmb_writer.h"
+#include "rle.h"
+
+// Size of the level of the cell layer benchmarks
+#define MICRO_ROWS 255
+#define MICRO_COLUMNS 255
+// Records of the string benchmark
+#define MICRO_ANNOTATIONS 4000
+#define MICRO_REGIONS 1000
+
+#ifdef __GLIBC__
+// Allocation counting. These replace the allocator functions of the C
+// library for the whole process and let glibc's allocator do the work.
+#define COUNT_ALLOCATIONS 1
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static atomic_size_t alloc_count;
+static atomic_size_t alloc_bytes;
+
+static void count_allocation(size_t size) {
+  atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&alloc_bytes, size, memory_order_relaxed);
+}
+
+void *malloc(size_t size) {
+  count_allocation(size);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+  count_allocation(n * size);
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  count_allocation(size);
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) { __libc_free(ptr); }
+#endif
+
+typedef struct BenchOptions {
+  unsigned long warmup;
+  unsigned long repetitions;
+  unsigned long threads; // of the decode and convert stages
+  bool micro;
+} BenchOptions;
+
+// Runs one iteration of a benchmark. Returns false if it failed.
+typedef bool (*BenchFn)(void *arg);
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void print_json_string(const char *str) {
+  putchar('"');
+  for (; *str != '\0'; ++str) {
+    unsigned char c = (unsigned char)*str;
+    if (c == '"' || c == '\\')
+      printf("\\%c", c);
+    else if (c < 0x20)
+      printf("\\u%04x", c);
+    else
+      putchar(c);
+  }
+  putchar('"');
+}
+
+// Runs fn for the warmup and the measured repetitions and prints the
+// result line. bytes is the amount of data one iteration processes, for the
+// throughput.
+static bool run_bench(const BenchOptions *opts, const char *name,
+                      const char *input, uint64_t bytes, BenchFn fn,
+                      void *arg) {
+  for (unsigned long i = 0; i < opts->warmup; ++i) {
+    if (!fn(arg)) {
+      fprintf(stderr, "%s failed on %s\n", name, input);
+      return false;
+    }
+  }
+  uint64_t *samples = malloc(opts->repetitions * sizeof(uint64_t));
+  if (samples == NULL)
+    return false;
+#ifdef COUNT_ALLOCATIONS
+  size_t count_before = atomic_load(&alloc_count);
+  size_t bytes_before = atomic_load(&alloc_bytes);
+#endif
+  for (unsigned long i = 0; i < opts->repetitions; ++i) {
+    uint64_t start = now_ns();
+    bool ok = fn(arg);
+    samples[i] = now_ns() - start;
+    if (!ok) {
+      fprintf(stderr, "%s failed on %s\n", name, input);
+      free(samples);
+      return false;
+    }
+  }
+#ifdef COUNT_ALLOCATIONS
+  // the sample array was allocated before, the counts are the benchmark's
+  double allocations =
+      (double)(atomic_load(&alloc_count) - count_before) / opts->repetitions;
+  double allocated =
+      (double)(atomic_load(&alloc_bytes) - bytes_before) / opts->repetitions;
+#endif
+  qsort(samples, opts->repetitions, sizeof(uint64_t), compare_u64);
+  uint64_t median = samples[opts->repetitions / 2];
+  uint64_t p99 = samples[(opts->repetitions * 99 + 99) / 100 - 1];
+  double mb_per_s = median > 0 ? (double)bytes * 1e3 / (double)median : 0;
+
+  printf("{ \"benchmark\": ");
+  print_json_string(name);
+  printf(", \"input\": ");
+  print_json_string(input);
+  printf(", \"bytes\": %llu, \"repetitions\": %lu, \"min_ns\": %llu, "
+         "\"median_ns\": %llu, \"p99_ns\": %llu, \"mb_per_s\": %.2f",
+         (unsigned long long)bytes, opts->repetitions,
+         (unsigned long long)samples[0], (unsigned long long)median,
+         (unsigned long long)p99, mb_per_s);
+#ifdef COUNT_ALLOCATIONS
+  printf(", \"allocations\": %.1f, \"allocated_bytes\": %.0f }\n", allocations,
+         allocated);
+#else
+  printf(", \"allocations\": null, \"allocated_bytes\": null }\n");
+#endif
+  fflush(stdout);
+  free(samples);
+  return true;
+}
+
+// Stages of the conversion of one corpus file
+
+typedef struct FileBench {
+  const char *path;
+  unsigned int threads;
+  RiffFile data; // read once for the decode stage
+  GmmSession session;
+  GmmChunkArray chunks; // decoded once for the output stages
+  JsonWriter *json;
+  FILE *null_file;
+} FileBench;
+
+static bool stage_read(void *arg) {
+  FileBench *fb = arg;
+  GmmSession session;
+  gmm_session_init(&session);
+  Context ctx = {(char *)fb->path};
+  RiffFile data;
+  FILE *file = fopen(fb->path, "rb");
+  RESULT res = RES_ERR;
+  if (file != NULL) {
+    res = read_riff(file, &ctx, &session, &data);
+    fclose(file);
+  }
+  if (res == RES_OK)
+    free_gmmfile(&data);
+  gmm_session_release(&session);
+  return res == RES_OK;
+}
+
+static bool stage_decode(void *arg) {
+  FileBench *fb = arg;
+  GmmSession session;
+  gmm_session_init(&session);
+  session.flags |= GMM_DECODE_STRING_VIEWS;
+  session.threads = fb->threads;
+  GmmChunkArray chunks;
+  RESULT res = decode_chunks(&fb->data, &session, &chunks);
+  gmm_session_release(&session);
+  return res == RES_OK;
+}
+
+static bool stage_json(void *arg) {
+  FileBench *fb = arg;
+  ConvertOptions opts = {CELLS_ARRAY, FORMAT_JSON, 1, NULL, NULL, NULL, NULL};
+  JsonWriter *out = fb->json;
+  json_writer_init(out, fileno(fb->null_file));
+  json_begin_array(out);
+  for (size_t i = 0; i < fb->chunks.len; ++i) {
+    if (export_gmm(out, &fb->chunks.data[i], &opts) < 0)
+      return false;
+  }
+  json_end_array(out);
+  return json_writer_flush(out) == RES_OK;
+}
+
+static bool stage_gmmb(void *arg) {
+  FileBench *fb = arg;
+  // the temporary tables of the writer come from a session of their own
+  GmmSession scratch;
+  gmm_session_init(&scratch);
+  RESULT res = write_gmmb(fb->null_file, &fb->chunks, &scratch);
+  gmm_session_release(&scratch);
+  return res == RES_OK && fflush(fb->null_file) == 0;
+}
+
+static bool stage_convert(void *arg) {
+  FileBench *fb = arg;
+  ConvertOptions opts = {CELLS_ARRAY, FORMAT_JSON, fb->threads, NULL, NULL,
+                         NULL,        NULL};
+  GmmError error = {RES_OK, ""};
+  return convert_file(fb->path, "/dev/null", &opts, &error) == RES_OK;
+}
+
+static bool bench_file(const BenchOptions *opts, const char *path) {
+  FileBench fb = {0};
+  fb.path = path;
+  fb.threads = (unsigned int)opts->threads;
+  Context ctx = {(char *)path};
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    fprintf(stderr, "Cannot open file %s\n", path);
+    return false;
+  }
+  uint64_t size = (uint64_t)st.st_size;
+
+  gmm_session_init(&fb.session);
+  fb.session.flags |= GMM_DECODE_STRING_VIEWS;
+  FILE *file = fopen(path, "rb");
+  fb.json = malloc(sizeof(JsonWriter));
+  fb.null_file = fopen("/dev/null", "wb");
+  bool ok = file != NULL && fb.json != NULL && fb.null_file != NULL &&
+            read_riff(file, &ctx, &fb.session, &fb.data) == RES_OK;
+  if (file != NULL)
+    fclose(file);
+  if (ok && decode_chunks(&fb.data, &fb.session, &fb.chunks) < 0) {
+    free_gmmfile(&fb.data);
+    ok = false;
+  }
+  if (!ok) {
+    fprintf(stderr, "Couldn't read %s: %s\n", path,
+            fb.session.error.code < 0 ? fb.session.error.message
+                                      : "out of memory");
+  } else {
+    ok = run_bench(opts, "read", path, size, stage_read, &fb) &&
+         run_bench(opts, "decode", path, size, stage_decode, &fb) &&
+         run_bench(opts, "export_json", path, size, stage_json, &fb) &&
+         run_bench(opts, "export_gmmb", path, size, stage_gmmb, &fb) &&
+         run_bench(opts, "convert", path, size, stage_convert, &fb);
+    free_gmmfile(&fb.data);
+  }
+  gmm_session_release(&fb.session);
+  if (fb.null_file != NULL)
+    fclose(fb.null_file);
+  free(fb.json);
+  return ok;
+}
+
+// Built-in maps of the micro benchmarks. They hold a single level and are
+// built as RIFF bodies, without the RIFF header.
+
+typedef struct Buffer {
+  uint8 *data;
+  size_t len;
+  size_t cap;
+} Buffer;
+
+static uint64_t rng_state = 1;
+
+// splitmix64, the data only has to be the same in every run
+static uint64_t next_random(void) {
+  uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static bool put(Buffer *b, const void *data, size_t n) {
+  if (b->len + n > b->cap) {
+    size_t cap = b->cap ? b->cap : 4096;
+    while (cap < b->len + n)
+      cap *= 2;
+    uint8 *grown = realloc(b->data, cap);
+    if (grown == NULL)
+      return false;
+    b->data = grown;
+    b->cap = cap;
+  }
+  memcpy(b->data + b->len, data, n);
+  b->len += n;
+  return true;
+}
+
+static bool put_u8(Buffer *b, unsigned int v) {
+  uint8 byte = (uint8)v;
+  return put(b, &byte, 1);
+}
+
+static bool put_u16(Buffer *b, unsigned int v) {
+  uint8 bytes[2] = {(uint8)v, (uint8)(v >> 8)};
+  return put(b, bytes, 2);
+}
+
+static bool put_u32(Buffer *b, uint32 v) {
+  uint8 bytes[4] = {(uint8)v, (uint8)(v >> 8), (uint8)(v >> 16),
+                    (uint8)(v >> 24)};
+  return put(b, bytes, 4);
+}
+
+// A string of len printable bytes with a 16 or 8 bit length prefix
+static bool put_string(Buffer *b, size_t len, bool wide) {
+  bool ok = wide ? put_u16(b, (unsigned int)len) : put_u8(b, (unsigned int)len);
+  for (size_t i = 0; i < len && ok; ++i)
+    ok = put_u8(b, 'a' + (unsigned int)(next_random() % 26));
+  return ok;
+}
+
+static size_t begin_chunk(Buffer *b, const char *id, const char *list_type) {
+  size_t start = b->len;
+  put(b, id, 4);
+  put_u32(b, 0);
+  if (list_type != NULL)
+    put(b, list_type, 4);
+  return start;
+}
+
+static bool end_chunk(Buffer *b, size_t start) {
+  uint32 size = (uint32)(b->len - start - 8);
+  if (b->data == NULL || b->len < start + 8)
+    return false;
+  memcpy(b->data + start + 4, &size, 4);
+  return size % 2 == 0 || put_u8(b, 0);
+}
+
+// Cells with runs of an average length of 8, like in hand-made maps
+static void make_cells(uint8 *cells, size_t count) {
+  size_t i = 0;
+  while (i < count) {
+    size_t run = 1 + next_random() % 16;
+    uint8 value = (uint8)(next_random() % 40);
+    for (; run > 0 && i < count; --run)
+      cells[i++] = value;
+  }
+}
+
+// Gridmonger RLE: runs of at least two equal bytes, literals otherwise
+static bool put_rle(Buffer *b, const uint8 *cells, size_t count) {
+  bool ok = true;
+  for (size_t i = 0; i < count && ok;) {
+    size_t run = 1;
+    while (i + run < count && run < 128 && cells[i + run] == cells[i])
+      ++run;
+    if (run > 1)
+      ok = put_u8(b, 0x80 | (unsigned int)(run - 1)) && put_u8(b, cells[i]);
+    else
+      ok = put_u8(b, cells[i]);
+    i += run;
+  }
+  return ok;
+}
+
+// A level with every cell layer stored with the given compression, and
+// num_annotations and num_regions records with strings
+static bool build_level(Buffer *b, GmmCellCompression compression,
+                        size_t rows, size_t columns, size_t num_annotations,
+                        size_t num_regions) {
+  size_t count = (rows + 1) * (columns + 1);
+  uint8 *cells = malloc(count);
+  if (cells == NULL)
+    return false;
+  size_t lvls = begin_chunk(b, "LIST", "lvls");
+  size_t lvl = begin_chunk(b, "LIST", "lvl ");
+  size_t chunk = begin_chunk(b, "prop", NULL);
+  bool ok = put_string(b, 8, true) && put_string(b, 8, true) &&
+            put_u16(b, 0) && put_u16(b, (unsigned int)rows) &&
+            put_u16(b, (unsigned int)columns) && put_u8(b, 0) &&
+            put_string(b, 8, true) && end_chunk(b, chunk);
+
+  chunk = begin_chunk(b, "cell", NULL);
+  for (int layer = 0; layer < GMM_LAYER_COUNT && ok; ++layer) {
+    ok = put_u8(b, compression);
+    if (compression == GMM_CELLS_RAW) {
+      for (size_t i = 0; i < count; ++i)
+        cells[i] = (uint8)(next_random() % 40);
+      ok = ok && put(b, cells, count);
+    } else if (compression == GMM_CELLS_RLE) {
+      make_cells(cells, count);
+      size_t length_at = b->len;
+      ok = ok && put_u32(b, 0) && put_rle(b, cells, count);
+      uint32 length = (uint32)(b->len - length_at - 4);
+      if (ok)
+        memcpy(b->data + length_at, &length, 4);
+    }
+  }
+  ok = ok && end_chunk(b, chunk);
+
+  if (num_annotations > 0) {
+    chunk = begin_chunk(b, "anno", NULL);
+    ok = ok && put_u16(b, (unsigned int)num_annotations);
+    for (size_t i = 0; i < num_annotations && ok; ++i) {
+      // custom ids and labels, the kinds with strings
+      bool custom = i % 2 == 0;
+      ok = put_u16(b, (unsigned int)(i % rows)) &&
+           put_u16(b, (unsigned int)(i % columns)) &&
+           put_u8(b, custom ? AK_CUSTOM : AK_LABEL) &&
+           (custom ? put_string(b, 24, false) : put_u8(b, 1)) &&
+           put_string(b, 48, true);
+    }
+    ok = ok && end_chunk(b, chunk);
+  }
+  if (num_regions > 0) {
+    chunk = begin_chunk(b, "regn", NULL);
+    ok = ok && put_u8(b, 1) && put_u16(b, 4) && put_u16(b, 4) &&
+         put_u8(b, 0) && put_u16(b, (unsigned int)num_regions);
+    for (size_t i = 0; i < num_regions && ok; ++i)
+      ok = put_string(b, 16, true) && put_string(b, 64, true);
+    ok = ok && end_chunk(b, chunk);
+  }
+  ok = ok && end_chunk(b, lvl) && end_chunk(b, lvls);
+  free(cells);
+  return ok;
+}
+
+typedef struct CellBench {
+  RiffFile data;
+  GmmSession session;
+  GmmChunkArray chunks;
+  RiffChunkLevelCell *cell;
+  Arena arena; // of the decoded layers, reset before every iteration
+} CellBench;
+
+// Decodes every layer of the cell chunk again
+static bool bench_cell_layers(void *arg) {
+  CellBench *cb = arg;
+  arena_reset(&cb->arena);
+  for (int layer = 0; layer < GMM_LAYER_COUNT; ++layer) {
+    cb->cell->layers[layer] = NULL;
+    if (gmm_cell_layer(cb->cell, layer) == NULL)
+      return false;
+  }
+  return true;
+}
+
+typedef struct RleBench {
+  RleImpl impl;
+  const uint8 *src;
+  size_t src_len;
+  uint8 *dest;
+  size_t dest_len;
+} RleBench;
+
+static bool bench_rle(void *arg) {
+  RleBench *rb = arg;
+  return rle_decode_impl(rb->impl, rb->dest, rb->dest_len, rb->src,
+                         rb->src_len) == RES_OK;
+}
+
+typedef struct StringBench {
+  RiffFile data;
+  unsigned int flags; // GMM_DECODE_STRING_VIEWS or 0
+} StringBench;
+
+static bool bench_strings(void *arg) {
+  StringBench *sb = arg;
+  GmmSession session;
+  gmm_session_init(&session);
+  session.flags |= sb->flags;
+  GmmChunkArray chunks;
+  RESULT res = decode_chunks(&sb->data, &session, &chunks);
+  gmm_session_release(&session);
+  return res == RES_OK;
+}
+
+static RiffChunkLevelCell *find_cell_chunk(GmmChunkArray *chunks) {
+  for (size_t i = 0; i < chunks->len; ++i) {
+    GmmChunk *ck = &chunks->data[i];
+    if (ck->ctype == GMM_LVL_CELL)
+      return &ck->level_cell_chunk;
+    if (ck->ctype == GMM_LIST) {
+      RiffChunkLevelCell *cell = find_cell_chunk(&ck->list_chunk.children);
+      if (cell != NULL)
+        return cell;
+    }
+  }
+  return NULL;
+}
+
+static bool bench_cells(const BenchOptions *opts, GmmCellCompression kind,
+                        const char *name) {
+  Buffer b = {0};
+  if (!build_level(&b, kind, MICRO_ROWS, MICRO_COLUMNS, 0, 0)) {
+    free(b.data);
+    return false;
+  }
+  CellBench cb = {0};
+  cb.data.length = b.len;
+  cb.data.data = b.data;
+  gmm_session_init(&cb.session);
+  cb.session.flags |= GMM_DECODE_LAZY_CELLS;
+  arena_init(&cb.arena, ARENA_DEFAULT_BLOCK_SIZE);
+  bool ok = decode_chunks(&cb.data, &cb.session, &cb.chunks) == RES_OK &&
+            (cb.cell = find_cell_chunk(&cb.chunks)) != NULL;
+  if (ok) {
+    cb.cell->arena = &cb.arena;
+    uint64_t bytes = (uint64_t)cb.cell->cells_count * GMM_LAYER_COUNT;
+    ok = run_bench(opts, name, "built-in", bytes, bench_cell_layers, &cb);
+  }
+
+  // the RLE stream of the first layer for the decoder benchmarks
+  GmmStoredLayer stored;
+  if (ok && kind == GMM_CELLS_RLE &&
+      gmm_cell_layer_stored(cb.cell, 0, &stored) == RES_OK) {
+    static const char *const impl_names[] = {"rle_scalar", "rle_sse2",
+                                             "rle_avx2"};
+    static const RleImpl impls[] = {RLE_IMPL_SCALAR, RLE_IMPL_SSE2,
+                                    RLE_IMPL_AVX2};
+    RleBench rb = {RLE_IMPL_SCALAR, stored.data, stored.len,
+                   malloc(cb.cell->cells_count), cb.cell->cells_count};
+    ok = rb.dest != NULL;
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]) && ok; ++i) {
+      rb.impl = impls[i];
+      // skip the implementations the CPU doesn't support
+      if (strcmp(rle_impl_name(rb.impl), impl_names[i] + 4) != 0)
+        continue;
+      ok = run_bench(opts, impl_names[i], "built-in", rb.dest_len, bench_rle,
+                     &rb);
+    }
+    free(rb.dest);
+  }
+  arena_release(&cb.arena);
+  gmm_session_release(&cb.session);
+  free(b.data);
+  return ok;
+}
+
+static bool bench_micro(const BenchOptions *opts) {
+  if (!bench_cells(opts, GMM_CELLS_RAW, "cells_raw") ||
+      !bench_cells(opts, GMM_CELLS_RLE, "cells_rle") ||
+      !bench_cells(opts, GMM_CELLS_ZERO, "cells_zero"))
+    return false;
+
+  Buffer b = {0};
+  bool ok = build_level(&b, GMM_CELLS_ZERO, 15, 15, MICRO_ANNOTATIONS,
+                        MICRO_REGIONS);
+  StringBench sb = {{b.len, b.data, NULL, 0, NULL}, GMM_DECODE_STRING_VIEWS};
+  ok = ok &&
+       run_bench(opts, "strings_view", "built-in", b.len, bench_strings, &sb);
+  sb.flags = 0;
+  ok = ok &&
+       run_bench(opts, "strings_copy", "built-in", b.len, bench_strings, &sb);
+  free(b.data);
+  return ok;
+}
+
+static void print_usage(const char *program) {
+  printf("gmm2json_bench times the conversion stages of gmm2json\n");
+  printf("Usage: %s [options] [file.gmm...]\n\n", program);
+  printf("Every file is read, decoded, written as JSON and GMMB and "
+         "converted as a\n"
+         "whole. Micro benchmarks of the cell layer, RLE and string "
+         "decoders run on\n"
+         "built-in data. Results are printed as one JSON object per "
+         "line.\n\n");
+  printf("Options:\n");
+  printf("  -w, --warmup <n>       untimed runs first (default: 3)\n");
+  printf("  -r, --repetitions <n>  timed runs (default: 20)\n");
+  printf("  -j, --threads <n>      threads of the decode and convert stages "
+         "(default: 1)\n");
+  printf("  -s, --skip-micro       only benchmark the files\n");
+}
+
+static bool parse_number(int argc, char **argv, int *i, unsigned long min,
+                         unsigned long max, unsigned long *out) {
+  char *end = NULL;
+  if (*i + 1 == argc)
+    return false;
+  const char *value = argv[++*i];
+  *out = strtoul(value, &end, 10);
+  return end != value && *end == '\0' && *out >= min && *out <= max;
+}
+
+static bool is_option(const char *arg, const char *short_name,
+                      const char *long_name) {
+  return strcmp(arg, short_name) == 0 || strcmp(arg, long_name) == 0;
+}
+
+int main(int argc, char **argv) {
+  BenchOptions opts = {3, 20, 1, true};
+  int first_file = argc;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    bool ok = true;
+    if (arg[0] != '-') {
+      first_file = i;
+      break;
+    }
+    if (is_option(arg, "-w", "--warmup")) {
+      ok = parse_number(argc, argv, &i, 0, 1000000, &opts.warmup);
+    } else if (is_option(arg, "-r", "--repetitions")) {
+      ok = parse_number(argc, argv, &i, 1, 1000000, &opts.repetitions);
+    } else if (is_option(arg, "-j", "--threads")) {
+      ok = parse_number(argc, argv, &i, 1, 1024, &opts.threads);
+    } else if (is_option(arg, "-s", "--skip-micro")) {
+      opts.micro = false;
+    } else {
+      print_usage(argv[0]);
+      return strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0
+                 ? EXIT_SUCCESS
+                 : EXIT_FAILURE;
+    }
+    if (!ok) {
+      printf("%s expects a valid number, see --help\n", arg);
+      return EXIT_FAILURE;
+    }
+  }
+
+  bool ok = !opts.micro || bench_micro(&opts);
+  for (int i = first_file; i < argc && ok; ++i)
+    ok = bench_file(&opts, argv[i]);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
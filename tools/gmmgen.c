@@ -0,0 +1,492 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+// gmmgen writes synthetic Gridmonger .gmm files, for tests and benchmarks.
+// It doesn't use the decoder sources, so it checks them against an
+// independent encoder. Every chunk type that gmm_file.c decodes is written,
+// with all annotation kinds and all three cell layer encodings.
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LAYER_COUNT 6
+#define CELLS_RAW 0
+#define CELLS_RLE 1
+#define CELLS_ZERO 2
+#define ANNOTATION_KINDS 5
+#define MAX_RUN 128
+
+typedef struct GenOptions {
+  uint64_t seed;
+  unsigned long levels;
+  unsigned long rows;
+  unsigned long columns;
+  double compressibility; // chance that a cell repeats the one before it
+  double empty_layers;    // chance that a layer has no cells set at all
+  unsigned long annotations; // per level
+  unsigned long regions;     // per level
+  unsigned long links;
+  unsigned long string_length;
+  const char *output;
+} GenOptions;
+
+// The output is built in memory, chunk sizes are patched in when the chunk
+// is closed
+typedef struct Buffer {
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+} Buffer;
+
+// Largest value of every cell layer, roughly like in Gridmonger maps
+static const uint8_t layer_max[LAYER_COUNT] = {40, 1, 8, 15, 15, 1};
+
+static uint64_t rng_state;
+
+// splitmix64, small and good enough for test data
+static uint64_t next_random(void) {
+  uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static unsigned long random_below(unsigned long n) {
+  return n > 0 ? (unsigned long)(next_random() % n) : 0;
+}
+
+static double random_unit(void) {
+  return (double)(next_random() >> 11) / (double)(1ULL << 53);
+}
+
+static void reserve(Buffer *b, size_t n) {
+  if (b->len + n <= b->cap)
+    return;
+  size_t cap = b->cap ? b->cap : 4096;
+  while (cap < b->len + n)
+    cap *= 2;
+  uint8_t *data = realloc(b->data, cap);
+  if (data == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  b->data = data;
+  b->cap = cap;
+}
+
+static void put(Buffer *b, const void *data, size_t n) {
+  reserve(b, n);
+  memcpy(b->data + b->len, data, n);
+  b->len += n;
+}
+
+static void put_u8(Buffer *b, unsigned int v) {
+  uint8_t byte = (uint8_t)v;
+  put(b, &byte, 1);
+}
+
+static void put_u16(Buffer *b, unsigned int v) {
+  uint8_t bytes[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+  put(b, bytes, 2);
+}
+
+static void put_u32(Buffer *b, uint32_t v) {
+  uint8_t bytes[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16),
+                      (uint8_t)(v >> 24)};
+  put(b, bytes, 4);
+}
+
+static void patch_u32(Buffer *b, size_t offset, uint32_t v) {
+  uint8_t bytes[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16),
+                      (uint8_t)(v >> 24)};
+  memcpy(b->data + offset, bytes, 4);
+}
+
+// Starts a chunk, or a LIST if list_type isn't NULL. Returns the offset
+// that end_chunk needs.
+static size_t begin_chunk(Buffer *b, const char *id, const char *list_type) {
+  size_t start = b->len;
+  put(b, id, 4);
+  put_u32(b, 0);
+  if (list_type != NULL)
+    put(b, list_type, 4);
+  return start;
+}
+
+static void end_chunk(Buffer *b, size_t start) {
+  size_t size = b->len - start - 8;
+  if (size > UINT32_MAX) {
+    fprintf(stderr, "A chunk is bigger than 4 GB, use smaller levels\n");
+    exit(EXIT_FAILURE);
+  }
+  patch_u32(b, start + 4, (uint32_t)size);
+  // chunks are word aligned
+  if (size % 2 == 1)
+    put_u8(b, 0);
+}
+
+// A string of exactly len bytes. It starts with prefix and is filled with
+// text that includes characters JSON has to escape and some UTF-8.
+static void make_string(char *out, size_t len, const char *prefix) {
+  static const char filler[] = "abcdefghij klmnopqrstuvwxyz \"\\\t/0123456789";
+  size_t i = 0;
+  for (; i < len && prefix[i] != '\0'; ++i)
+    out[i] = prefix[i];
+  while (i < len) {
+    if (len - i >= 2 && random_below(16) == 0) {
+      out[i++] = (char)0xc3; // é
+      out[i++] = (char)0xa9;
+    } else {
+      out[i++] = filler[random_below(sizeof(filler) - 1)];
+    }
+  }
+  out[len] = '\0';
+}
+
+// A string with a 16 bit length prefix
+static void put_wstr(Buffer *b, const char *prefix, size_t len) {
+  char text[65536];
+  if (len < strlen(prefix))
+    len = strlen(prefix);
+  if (len > 65535)
+    len = 65535;
+  make_string(text, len, prefix);
+  put_u16(b, (unsigned int)len);
+  put(b, text, len);
+}
+
+// A string with an 8 bit length prefix
+static void put_bstr(Buffer *b, const char *prefix, size_t len) {
+  char text[256];
+  if (len < strlen(prefix))
+    len = strlen(prefix);
+  if (len > 255)
+    len = 255;
+  make_string(text, len, prefix);
+  put_u8(b, (unsigned int)len);
+  put(b, text, len);
+}
+
+static void put_coords(Buffer *b) {
+  put_u8(b, random_below(2));   // origin
+  put_u8(b, random_below(2));   // row_style
+  put_u8(b, random_below(2));   // column_style
+  put_u16(b, random_below(10)); // row_start
+  put_u16(b, random_below(10)); // column_start
+}
+
+// Gridmonger's run length encoding: a byte with the high bit set is a run
+// of (byte & 0x7f) + 1 times the next byte, other bytes are single cells.
+// Trailing zeros are left out, the decoder fills them in.
+static size_t rle_encode(uint8_t *out, const uint8_t *cells, size_t count) {
+  while (count > 0 && cells[count - 1] == 0)
+    count--;
+  size_t len = 0;
+  for (size_t i = 0; i < count;) {
+    size_t run = 1;
+    while (i + run < count && run < MAX_RUN && cells[i + run] == cells[i])
+      run++;
+    if (run > 1 || cells[i] >= 0x80) {
+      out[len++] = (uint8_t)(0x80 | (run - 1));
+      out[len++] = cells[i];
+    } else {
+      out[len++] = cells[i];
+    }
+    i += run;
+  }
+  return len;
+}
+
+// Fills a layer and writes it in the smallest of the three encodings
+static void put_cell_layer(Buffer *b, int layer, uint8_t *cells,
+                           uint8_t *encoded, size_t count,
+                           const GenOptions *opts) {
+  bool empty = random_unit() < opts->empty_layers;
+  uint8_t value = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (i == 0 || random_unit() >= opts->compressibility)
+      value = (uint8_t)random_below((unsigned long)layer_max[layer] + 1);
+    cells[i] = empty ? 0 : value;
+  }
+  size_t len = rle_encode(encoded, cells, count);
+  if (len == 0) {
+    put_u8(b, CELLS_ZERO);
+  } else if (len + 4 < count) {
+    put_u8(b, CELLS_RLE);
+    put_u32(b, (uint32_t)len);
+    put(b, encoded, len);
+  } else {
+    put_u8(b, CELLS_RAW);
+    put(b, cells, count);
+  }
+}
+
+static void put_annotations(Buffer *b, const GenOptions *opts) {
+  char prefix[32];
+  unsigned long count = opts->annotations > 65535 ? 65535 : opts->annotations;
+  put_u16(b, count);
+  for (unsigned long i = 0; i < count; ++i) {
+    // every kind is used in turn
+    unsigned int kind = (unsigned int)(i % ANNOTATION_KINDS);
+    put_u16(b, random_below(opts->rows));
+    put_u16(b, random_below(opts->columns));
+    put_u8(b, kind);
+    switch (kind) {
+    case 1: // indexed
+      put_u16(b, random_below(100));
+      put_u8(b, random_below(4));
+      break;
+    case 2: // custom id
+      snprintf(prefix, sizeof(prefix), "id%lu", i);
+      put_bstr(b, prefix, opts->string_length > 8 ? 8 : opts->string_length);
+      break;
+    case 3: // icon
+      put_u8(b, random_below(40));
+      break;
+    case 4: // label
+      put_u8(b, random_below(4));
+      break;
+    }
+    snprintf(prefix, sizeof(prefix), "note %lu ", i);
+    put_wstr(b, prefix, opts->string_length);
+  }
+}
+
+static void put_regions(Buffer *b, const GenOptions *opts) {
+  char prefix[32];
+  unsigned long count = opts->regions > 65535 ? 65535 : opts->regions;
+  put_u8(b, count > 0);
+  put_u16(b, opts->rows > 4 ? opts->rows / 4 : 1);
+  put_u16(b, opts->columns > 4 ? opts->columns / 4 : 1);
+  put_u8(b, random_below(2));
+  put_u16(b, count);
+  for (unsigned long i = 0; i < count; ++i) {
+    snprintf(prefix, sizeof(prefix), "Region %lu ", i);
+    put_wstr(b, prefix, opts->string_length);
+    put_wstr(b, "", opts->string_length / 2);
+  }
+}
+
+static void put_level(Buffer *b, unsigned long index, uint8_t *cells,
+                      uint8_t *encoded, const GenOptions *opts) {
+  char prefix[32];
+  size_t level = begin_chunk(b, "LIST", "lvl ");
+
+  size_t chunk = begin_chunk(b, "prop", NULL);
+  snprintf(prefix, sizeof(prefix), "Location %lu ", index / 4);
+  put_wstr(b, prefix, opts->string_length);
+  // the names start with a unique prefix, so they can be selected
+  snprintf(prefix, sizeof(prefix), "Level %lu", index);
+  put_wstr(b, prefix, 0);
+  int elevation = (int)random_below(21) - 10;
+  put_u16(b, (uint16_t)elevation);
+  put_u16(b, opts->rows);
+  put_u16(b, opts->columns);
+  put_u8(b, random_below(2)); // override_coord_opts
+  put_wstr(b, "", opts->string_length);
+  end_chunk(b, chunk);
+
+  chunk = begin_chunk(b, "coor", NULL);
+  put_coords(b);
+  end_chunk(b, chunk);
+
+  chunk = begin_chunk(b, "cell", NULL);
+  size_t count = (opts->rows + 1) * (opts->columns + 1);
+  for (int layer = 0; layer < LAYER_COUNT; ++layer)
+    put_cell_layer(b, layer, cells, encoded, count, opts);
+  end_chunk(b, chunk);
+
+  chunk = begin_chunk(b, "anno", NULL);
+  put_annotations(b, opts);
+  end_chunk(b, chunk);
+
+  chunk = begin_chunk(b, "regn", NULL);
+  put_regions(b, opts);
+  end_chunk(b, chunk);
+
+  end_chunk(b, level);
+}
+
+static void put_map(Buffer *b, const GenOptions *opts) {
+  size_t count = (opts->rows + 1) * (opts->columns + 1);
+  uint8_t *cells = malloc(count);
+  // an RLE stream is at most twice as long as the cells
+  uint8_t *encoded = malloc(count * 2);
+  if (cells == NULL || encoded == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t riff = begin_chunk(b, "RIFF", "GRMM");
+  size_t map = begin_chunk(b, "LIST", "map ");
+  size_t chunk = begin_chunk(b, "prop", NULL);
+  put_u16(b, 4); // version
+  put_wstr(b, "Generated map ", opts->string_length);
+  put_wstr(b, "Game ", opts->string_length);
+  put_wstr(b, "gmmgen ", opts->string_length);
+  put_bstr(b, "2025-01-01 12:00:00", 0);
+  put_wstr(b, "", opts->string_length);
+  end_chunk(b, chunk);
+  chunk = begin_chunk(b, "coor", NULL);
+  put_coords(b);
+  end_chunk(b, chunk);
+  end_chunk(b, map);
+
+  size_t levels = begin_chunk(b, "LIST", "lvls");
+  for (unsigned long i = 0; i < opts->levels; ++i)
+    put_level(b, i, cells, encoded, opts);
+  end_chunk(b, levels);
+
+  chunk = begin_chunk(b, "lnks", NULL);
+  unsigned long links = opts->levels > 0 ? opts->links : 0;
+  put_u16(b, links);
+  for (unsigned long i = 0; i < links; ++i) {
+    put_u16(b, random_below(opts->levels));
+    put_u16(b, random_below(opts->rows));
+    put_u16(b, random_below(opts->columns));
+    put_u16(b, random_below(opts->levels));
+    put_u16(b, random_below(opts->rows));
+    put_u16(b, random_below(opts->columns));
+  }
+  end_chunk(b, chunk);
+
+  // a chunk that the decoder skips
+  chunk = begin_chunk(b, "disp", NULL);
+  put(b, "\0\1\2", 3);
+  end_chunk(b, chunk);
+
+  end_chunk(b, riff);
+  free(encoded);
+  free(cells);
+}
+
+static void print_usage(const char *program) {
+  printf("gmmgen writes a synthetic Gridmonger .gmm file\n");
+  printf("Usage: %s [options]\n\n", program);
+  printf("Options:\n");
+  printf("  -o, --output <file>       write to file instead of stdout\n");
+  printf("  -s, --seed <n>            seed of the random data (default: 1)\n");
+  printf("  -n, --levels <n>          number of levels (default: 4)\n");
+  printf("  -r, --rows <n>            rows of every level (default: 32)\n");
+  printf("  -c, --columns <n>         columns of every level (default: 32)\n");
+  printf("  -z, --compressibility <p> chance from 0 to 1 that a cell repeats "
+         "the\n"
+         "                            cell before it (default: 0.9)\n");
+  printf("  -e, --empty-layers <p>    chance that a cell layer is all 0 "
+         "(default: 0.1)\n");
+  printf("  -a, --annotations <n>     annotations per level (default: 10)\n");
+  printf("  -g, --regions <n>         regions per level (default: 4)\n");
+  printf("  -k, --links <n>           links between levels (default: 8)\n");
+  printf("  -t, --string-length <n>   bytes of names, notes and texts "
+         "(default: 16)\n");
+}
+
+// Parses the value of option i. Returns false if it's missing or invalid.
+static bool parse_number(int argc, char **argv, int *i, unsigned long max,
+                         unsigned long *out) {
+  char *end = NULL;
+  if (*i + 1 == argc)
+    return false;
+  const char *value = argv[++*i];
+  *out = strtoul(value, &end, 10);
+  return end != value && *end == '\0' && *out <= max;
+}
+
+static bool parse_chance(int argc, char **argv, int *i, double *out) {
+  char *end = NULL;
+  if (*i + 1 == argc)
+    return false;
+  const char *value = argv[++*i];
+  *out = strtod(value, &end);
+  return end != value && *end == '\0' && *out >= 0 && *out <= 1;
+}
+
+static bool is_option(const char *arg, const char *short_name,
+                      const char *long_name) {
+  return strcmp(arg, short_name) == 0 || strcmp(arg, long_name) == 0;
+}
+
+int main(int argc, char **argv) {
+  GenOptions opts = {1, 4, 32, 32, 0.9, 0.1, 10, 4, 8, 16, NULL};
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    unsigned long seed;
+    bool ok = true;
+    if (is_option(arg, "-o", "--output")) {
+      ok = i + 1 < argc;
+      opts.output = ok ? argv[++i] : NULL;
+    } else if (is_option(arg, "-s", "--seed")) {
+      ok = parse_number(argc, argv, &i, ULONG_MAX, &seed);
+      opts.seed = seed;
+    } else if (is_option(arg, "-n", "--levels")) {
+      ok = parse_number(argc, argv, &i, 1000000, &opts.levels);
+    } else if (is_option(arg, "-r", "--rows")) {
+      ok = parse_number(argc, argv, &i, 65534, &opts.rows);
+    } else if (is_option(arg, "-c", "--columns")) {
+      ok = parse_number(argc, argv, &i, 65534, &opts.columns);
+    } else if (is_option(arg, "-z", "--compressibility")) {
+      ok = parse_chance(argc, argv, &i, &opts.compressibility);
+    } else if (is_option(arg, "-e", "--empty-layers")) {
+      ok = parse_chance(argc, argv, &i, &opts.empty_layers);
+    } else if (is_option(arg, "-a", "--annotations")) {
+      ok = parse_number(argc, argv, &i, 65535, &opts.annotations);
+    } else if (is_option(arg, "-g", "--regions")) {
+      ok = parse_number(argc, argv, &i, 65535, &opts.regions);
+    } else if (is_option(arg, "-k", "--links")) {
+      ok = parse_number(argc, argv, &i, 65535, &opts.links);
+    } else if (is_option(arg, "-t", "--string-length")) {
+      ok = parse_number(argc, argv, &i, 65535, &opts.string_length);
+    } else {
+      print_usage(argv[0]);
+      return strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0
+                 ? EXIT_SUCCESS
+                 : EXIT_FAILURE;
+    }
+    if (!ok) {
+      printf("%s expects a valid value, see --help\n", arg);
+      return EXIT_FAILURE;
+    }
+  }
+  if (opts.rows == 0 || opts.columns == 0) {
+    printf("Levels need at least one row and column\n");
+    return EXIT_FAILURE;
+  }
+
+  rng_state = opts.seed;
+  Buffer b = {NULL, 0, 0};
+  put_map(&b, &opts);
+  FILE *out = opts.output != NULL ? fopen(opts.output, "wb") : stdout;
+  if (out == NULL) {
+    fprintf(stderr, "Couldn't create %s\n", opts.output);
+    free(b.data);
+    return EXIT_FAILURE;
+  }
+  bool written = fwrite(b.data, 1, b.len, out) == b.len;
+  if ((out != stdout ? fclose(out) : fflush(out)) != 0)
+    written = false;
+  free(b.data);
+  if (!written) {
+    fprintf(stderr, "Couldn't write the map\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,364 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "json_writer.h"
+#include "trace.h"
+
+// Chunk types have the indices of GmmChunkType, GMM_UNKNOWN is the last
+#define TRACE_CHUNK_TYPES (GMM_CUSTOM + 2)
+#define TRACE_LAYER_KINDS (GMM_CELLS_ZERO + 1)
+
+static const char *const stage_names[GMM_STAGE_COUNT] = {"read", "decode",
+                                                         "write"};
+
+typedef struct TraceEvent {
+  const char *name;
+  const char *category;
+  const char *file; // NULL for events without a file
+  uint64_t start;
+  uint64_t duration;
+  int64_t level; // -1 for events without a level
+  uint64_t bytes;
+  unsigned int thread;
+} TraceEvent;
+
+DYNARRAY(TraceEventArray, TraceEvent, trace_event_array)
+
+// Counters that are updated for every chunk, layer and string
+typedef struct ChunkStats {
+  _Atomic uint64_t count;
+  _Atomic uint64_t bytes;
+  _Atomic uint64_t ns;
+} ChunkStats;
+
+typedef struct LevelStats {
+  uint64_t count;
+  uint64_t ns;
+  uint64_t max_ns;
+  unsigned int slowest; // index of the level that took max_ns
+} LevelStats;
+
+struct GmmTrace {
+  uint64_t start; // events are relative to it
+  bool events_enabled;
+  ChunkStats chunks[TRACE_CHUNK_TYPES];
+  ChunkStats layers[TRACE_LAYER_KINDS]; // bytes are stored bytes
+  _Atomic uint64_t layer_cells[TRACE_LAYER_KINDS];
+  _Atomic uint64_t strings;
+  _Atomic uint64_t string_bytes;
+
+  // The rest is updated more rarely and guarded by lock
+  pthread_mutex_t lock;
+  uint64_t stage_count[GMM_STAGE_COUNT];
+  uint64_t stage_ns[GMM_STAGE_COUNT];
+  uint64_t stage_bytes[GMM_STAGE_COUNT];
+  LevelStats levels[GMM_STAGE_COUNT];
+  uint64_t sessions;
+  uint64_t arena_blocks;
+  uint64_t arena_bytes;
+  uint64_t arena_max_bytes; // of a single session
+  TraceEventArray events;   // if events_enabled
+  Arena names;              // copies of the file names of events
+};
+
+static atomic_uint next_thread_id;
+// Small ids of the threads for the events, 0 until the first event
+static _Thread_local unsigned int thread_id;
+
+GmmTrace *gmm_trace_create(bool events) {
+  GmmTrace *trace = calloc(1, sizeof(GmmTrace));
+  if (trace == NULL)
+    return NULL;
+  trace->events_enabled = events;
+  if (events) {
+    if (trace_event_array_init(&trace->events, NULL, 256) < 0) {
+      free(trace);
+      return NULL;
+    }
+  }
+  pthread_mutex_init(&trace->lock, NULL);
+  arena_init(&trace->names, 4096);
+  trace->start = gmm_trace_now();
+  return trace;
+}
+
+void gmm_trace_free(GmmTrace *trace) {
+  if (trace == NULL)
+    return;
+  if (trace->events_enabled)
+    trace_event_array_free(&trace->events);
+  arena_release(&trace->names);
+  pthread_mutex_destroy(&trace->lock);
+  free(trace);
+}
+
+uint64_t gmm_trace_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Adds an event that ends now. Has to be called with the lock held.
+static void add_event(GmmTrace *trace, const char *name, const char *category,
+                      const char *file, uint64_t start, int64_t level,
+                      uint64_t bytes) {
+  if (!trace->events_enabled)
+    return;
+  if (thread_id == 0)
+    thread_id = atomic_fetch_add(&next_thread_id, 1) + 1;
+  TraceEvent *event = trace_event_array_push(&trace->events);
+  // events that don't fit are dropped, the trace still shows the rest
+  if (event == NULL)
+    return;
+  event->name = name;
+  event->category = category;
+  event->file = file;
+  event->start = start;
+  event->duration = gmm_trace_now() - start;
+  event->level = level;
+  event->bytes = bytes;
+  event->thread = thread_id;
+}
+
+void gmm_trace_stage(GmmTrace *trace, GmmTraceStage stage, const char *file,
+                     uint64_t start, uint64_t bytes) {
+  uint64_t ns = gmm_trace_now() - start;
+  pthread_mutex_lock(&trace->lock);
+  trace->stage_count[stage]++;
+  trace->stage_ns[stage] += ns;
+  trace->stage_bytes[stage] += bytes;
+  if (trace->events_enabled) {
+    // the file name may not outlive the conversion
+    char *copy = NULL;
+    if (file != NULL && (copy = arena_alloc(&trace->names, strlen(file) + 1)))
+      strcpy(copy, file);
+    add_event(trace, stage_names[stage], "stage", copy, start, -1, bytes);
+  }
+  pthread_mutex_unlock(&trace->lock);
+}
+
+void gmm_trace_level(GmmTrace *trace, GmmTraceStage stage, unsigned int index,
+                     uint64_t start) {
+  uint64_t ns = gmm_trace_now() - start;
+  pthread_mutex_lock(&trace->lock);
+  LevelStats *levels = &trace->levels[stage];
+  levels->count++;
+  levels->ns += ns;
+  if (ns >= levels->max_ns) {
+    levels->max_ns = ns;
+    levels->slowest = index;
+  }
+  add_event(trace, "level", stage_names[stage], NULL, start, index, 0);
+  pthread_mutex_unlock(&trace->lock);
+}
+
+void gmm_trace_chunk(GmmTrace *trace, GmmChunkType type, size_t size,
+                     uint64_t start) {
+  uint64_t ns = gmm_trace_now() - start;
+  unsigned int slot = type <= GMM_CUSTOM ? type : TRACE_CHUNK_TYPES - 1;
+  ChunkStats *stats = &trace->chunks[slot];
+  atomic_fetch_add_explicit(&stats->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&stats->bytes, size, memory_order_relaxed);
+  atomic_fetch_add_explicit(&stats->ns, ns, memory_order_relaxed);
+  if (trace->events_enabled) {
+    pthread_mutex_lock(&trace->lock);
+    add_event(trace, chunk_type_to_str(type), "decode", NULL, start, -1,
+              size);
+    pthread_mutex_unlock(&trace->lock);
+  }
+}
+
+void gmm_trace_layer(GmmTrace *trace, GmmCellCompression compression,
+                     size_t size, size_t cells) {
+  if (compression >= TRACE_LAYER_KINDS)
+    return;
+  atomic_fetch_add_explicit(&trace->layers[compression].count, 1,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&trace->layers[compression].bytes, size,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&trace->layer_cells[compression], cells,
+                            memory_order_relaxed);
+}
+
+void gmm_trace_string(GmmTrace *trace, size_t len) {
+  atomic_fetch_add_explicit(&trace->strings, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&trace->string_bytes, len, memory_order_relaxed);
+}
+
+void gmm_trace_arena(GmmTrace *trace, const Arena *arena) {
+  uint64_t blocks = 0;
+  uint64_t bytes = 0;
+  for (const ArenaBlock *block = arena->head; block != NULL;
+       block = block->next) {
+    blocks++;
+    bytes += sizeof(ArenaBlock) + block->size;
+  }
+  pthread_mutex_lock(&trace->lock);
+  trace->sessions++;
+  trace->arena_blocks += blocks;
+  trace->arena_bytes += bytes;
+  if (bytes > trace->arena_max_bytes)
+    trace->arena_max_bytes = bytes;
+  pthread_mutex_unlock(&trace->lock);
+}
+
+static double to_ms(uint64_t ns) { return (double)ns / 1e6; }
+
+static double to_mb(uint64_t bytes) { return (double)bytes / 1e6; }
+
+void gmm_trace_print_stats(GmmTrace *trace, FILE *out) {
+  pthread_mutex_lock(&trace->lock);
+  fprintf(out, "%-12s %8s %12s %10s\n", "Stage", "runs", "time ms", "MB");
+  for (int s = 0; s < GMM_STAGE_COUNT; ++s) {
+    fprintf(out, "%-12s %8llu %12.3f %10.3f\n", stage_names[s],
+            (unsigned long long)trace->stage_count[s],
+            to_ms(trace->stage_ns[s]), to_mb(trace->stage_bytes[s]));
+  }
+
+  fprintf(out, "\n%-12s %8s %12s %10s\n", "Chunk", "count", "bytes",
+          "decode ms");
+  for (unsigned int t = 0; t < TRACE_CHUNK_TYPES; ++t) {
+    ChunkStats *stats = &trace->chunks[t];
+    uint64_t count = atomic_load(&stats->count);
+    if (count == 0)
+      continue;
+    GmmChunkType type = t < TRACE_CHUNK_TYPES - 1 ? t : GMM_UNKNOWN;
+    fprintf(out, "%-12s %8llu %12llu %10.3f\n", chunk_type_to_str(type),
+            (unsigned long long)count,
+            (unsigned long long)atomic_load(&stats->bytes),
+            to_ms(atomic_load(&stats->ns)));
+  }
+
+  static const char *const layer_names[TRACE_LAYER_KINDS] = {"raw", "rle",
+                                                             "zero"};
+  fprintf(out, "\n%-12s %8s %12s %10s %9s\n", "Cell layers", "count",
+          "stored", "cells", "expansion");
+  for (int c = 0; c < TRACE_LAYER_KINDS; ++c) {
+    uint64_t stored = atomic_load(&trace->layers[c].bytes);
+    uint64_t cells = atomic_load(&trace->layer_cells[c]);
+    fprintf(out, "%-12s %8llu %12llu %10llu", layer_names[c],
+            (unsigned long long)atomic_load(&trace->layers[c].count),
+            (unsigned long long)stored, (unsigned long long)cells);
+    // zero layers store no cells at all
+    if (stored > 0 && c != GMM_CELLS_ZERO)
+      fprintf(out, " %8.1fx\n", (double)cells / (double)stored);
+    else
+      fprintf(out, " %9s\n", "-");
+  }
+
+  fprintf(out, "\nStrings: %llu, %llu bytes\n",
+          (unsigned long long)atomic_load(&trace->strings),
+          (unsigned long long)atomic_load(&trace->string_bytes));
+  for (int s = GMM_STAGE_DECODE; s <= GMM_STAGE_WRITE; ++s) {
+    LevelStats *levels = &trace->levels[s];
+    if (levels->count == 0)
+      continue;
+    fprintf(out,
+            "Levels (%s): %llu, %.3f ms on average, slowest is level %u "
+            "with %.3f ms\n",
+            stage_names[s], (unsigned long long)levels->count,
+            to_ms(levels->ns) / (double)levels->count, levels->slowest,
+            to_ms(levels->max_ns));
+  }
+  fprintf(out,
+          "Memory: %llu arena blocks with %.3f MB in %llu sessions, "
+          "at most %.3f MB in one\n",
+          (unsigned long long)trace->arena_blocks, to_mb(trace->arena_bytes),
+          (unsigned long long)trace->sessions, to_mb(trace->arena_max_bytes));
+  pthread_mutex_unlock(&trace->lock);
+}
+
+RESULT gmm_trace_write_chrome(GmmTrace *trace, const char *path,
+                              GmmError *error) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    gmm_set_error(error, RES_ERR, "Couldn't create %s: %s", path,
+                  strerror(errno));
+    return RES_ERR;
+  }
+  JsonWriter *out = malloc(sizeof(JsonWriter));
+  if (out == NULL) {
+    close(fd);
+    gmm_set_error(error, RES_OUT_OF_MEMORY, "Out of memory");
+    return RES_OUT_OF_MEMORY;
+  }
+  json_writer_init(out, fd);
+  json_begin_object(out);
+  json_key(out, "traceEvents");
+  json_begin_array(out);
+  pthread_mutex_lock(&trace->lock);
+  size_t count = trace->events_enabled ? trace->events.len : 0;
+  for (size_t i = 0; i < count; ++i) {
+    const TraceEvent *event = &trace->events.data[i];
+    // complete events, with times in microseconds
+    json_begin_object(out);
+    json_key(out, "name");
+    json_string(out, event->name, strlen(event->name));
+    json_key(out, "cat");
+    json_string(out, event->category, strlen(event->category));
+    json_key(out, "ph");
+    json_string(out, "X", 1);
+    json_key(out, "ts");
+    json_uint(out, (event->start - trace->start) / 1000);
+    json_key(out, "dur");
+    json_uint(out, event->duration / 1000);
+    json_key(out, "pid");
+    json_uint(out, 1);
+    json_key(out, "tid");
+    json_uint(out, event->thread);
+    json_key(out, "args");
+    json_begin_object(out);
+    if (event->file != NULL) {
+      json_key(out, "file");
+      json_string(out, event->file, strlen(event->file));
+    }
+    if (event->level >= 0) {
+      json_key(out, "level");
+      json_int(out, event->level);
+    }
+    if (event->bytes > 0) {
+      json_key(out, "bytes");
+      json_uint(out, event->bytes);
+    }
+    json_end_object(out);
+    json_end_object(out);
+  }
+  pthread_mutex_unlock(&trace->lock);
+  json_end_array(out);
+  json_key(out, "displayTimeUnit");
+  json_string(out, "ms", 2);
+  json_end_object(out);
+  json_raw(out, "\n", 1);
+  RESULT res = json_writer_flush(out);
+  if (close(fd) != 0 || res < 0) {
+    gmm_set_error(error, RES_ERR, "Couldn't write %s", path);
+    res = RES_ERR;
+  }
+  free(out);
+  return res;
+}
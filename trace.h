@@ -0,0 +1,75 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "gmm_file.h"
+
+// Statistics and trace events of conversions. Instrumented code gets a
+// GmmTrace pointer and does nothing but check it while it is NULL, so
+// conversions without tracing aren't slowed down. A trace can be shared by
+// conversions on any number of threads.
+
+typedef enum GmmTraceStage {
+  GMM_STAGE_READ = 0, // reading or mapping the file
+  GMM_STAGE_DECODE,
+  GMM_STAGE_WRITE, // JSON or GMMB output
+  GMM_STAGE_COUNT,
+} GmmTraceStage;
+
+// With events, every span is also kept as an event for
+// gmm_trace_write_chrome. Returns NULL when out of memory.
+GmmTrace *gmm_trace_create(bool events);
+void gmm_trace_free(GmmTrace *trace);
+// Monotonic clock in nanoseconds, for the start of the spans below
+uint64_t gmm_trace_now(void);
+
+// The spans end when they are recorded.
+// A stage of the conversion of file. bytes is the size of the input for
+// reading and decoding, and of the output for writing (0 if unknown).
+void gmm_trace_stage(GmmTrace *trace, GmmTraceStage stage, const char *file,
+                     uint64_t start, uint64_t bytes);
+// Decoding or writing of the level with the given index
+void gmm_trace_level(GmmTrace *trace, GmmTraceStage stage, unsigned int index,
+                     uint64_t start);
+// Decoding of a chunk that isn't a LIST, with a body of size bytes
+void gmm_trace_chunk(GmmTrace *trace, GmmChunkType type, size_t size,
+                     uint64_t start);
+
+// A cell layer as it is stored in the file, size includes the compression
+// byte
+void gmm_trace_layer(GmmTrace *trace, GmmCellCompression compression,
+                     size_t size, size_t cells);
+void gmm_trace_string(GmmTrace *trace, size_t len);
+// The memory a session holds in its arena, when it is released
+void gmm_trace_arena(GmmTrace *trace, const Arena *arena);
+
+// Prints a summary of everything recorded so far
+void gmm_trace_print_stats(GmmTrace *trace, FILE *out);
+// Writes the events in the Chrome trace event format, which Perfetto and
+// chrome://tracing open.
+RESULT gmm_trace_write_chrome(GmmTrace *trace, const char *path,
+                              GmmError *error);
+
+#endif // TRACE_H
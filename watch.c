@@ -0,0 +1,371 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#include "dynarray.h"
+#include "watch.h"
+#include "xxh64.h"
+
+// Saves that come in faster than this are handled as one
+#define WATCH_SETTLE_MS 20
+
+// What is kept of a level between updates
+struct WatchedLevel {
+  uint64_t raw_hash; // of the "lvl " LIST in the .gmm file
+  ShardLevel entry;
+  // The manifest fields of the level, with copies of the strings
+  RiffChunkLevelProperties prop;
+  bool has_prop;
+};
+
+struct Watch {
+  const char *path;
+  const char *dir;
+  const ConvertOptions *opts;
+  uint64_t file_hash; // of the whole file at the last successful update
+  bool exported;      // file_hash is valid
+  struct WatchedLevel *levels;
+  size_t num_levels;
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint32 read_le32(const uint8 *data) {
+  return (uint32)data[0] | ((uint32)data[1] << 8) | ((uint32)data[2] << 16) |
+         ((uint32)data[3] << 24);
+}
+
+// Hashes the bytes of every "lvl " LIST in the "lvls" LIST of the file.
+// Returns the number of levels, or -1 if hashes can't be allocated. A
+// damaged file gives the levels up to the damage, decoding reports it.
+static long hash_levels(const RiffFile *data, uint64_t **hashes) {
+  const uint8 *pos = data->data;
+  const uint8 *end = data->data + data->length;
+  size_t count = 0;
+  size_t capacity = 64;
+  *hashes = malloc(capacity * sizeof(uint64_t));
+  if (*hashes == NULL)
+    return -1;
+  // the top level chunks, then the children of "lvls"
+  const uint8 *lvls_end = NULL;
+  while (end - pos >= 8) {
+    uint32 id = read_le32(pos);
+    size_t size = read_le32(pos + 4);
+    if (size > (size_t)(end - pos) - 8)
+      break;
+    const uint8 *next = pos + 8 + size + size % 2;
+    if (lvls_end == NULL) {
+      if (id == GMM_FOURCC('L', 'I', 'S', 'T') && size >= 4 &&
+          read_le32(pos + 8) == GMM_FOURCC('l', 'v', 'l', 's')) {
+        // continue with the children
+        lvls_end = pos + 8 + size;
+        end = lvls_end;
+        pos += 12;
+        continue;
+      }
+    } else if (id == GMM_FOURCC('L', 'I', 'S', 'T')) {
+      if (count == capacity) {
+        capacity *= 2;
+        uint64_t *grown = realloc(*hashes, capacity * sizeof(uint64_t));
+        if (grown == NULL)
+          return -1;
+        *hashes = grown;
+      }
+      (*hashes)[count++] = xxh64(pos, 8 + size, 0);
+    }
+    pos = next > end ? end : next;
+  }
+  return (long)count;
+}
+
+static void set_string(GmmString *dest, const GmmString *src) {
+  char *copy = malloc(src->len + 1);
+  free((void *)dest->str);
+  dest->str = copy;
+  dest->len = copy != NULL ? src->len : 0;
+  if (copy != NULL) {
+    memcpy(copy, src->str, src->len);
+    copy[src->len] = '\0';
+  }
+}
+
+static void forget_level(struct WatchedLevel *level) {
+  free((void *)level->prop.location_name.str);
+  free((void *)level->prop.level_name.str);
+  memset(level, 0, sizeof(struct WatchedLevel));
+}
+
+// Resizes the list of levels. Files of levels that don't exist anymore are
+// removed.
+static RESULT resize_levels(struct Watch *watch, size_t num_levels) {
+  char path[PATH_MAX];
+  for (size_t i = num_levels; i < watch->num_levels; ++i) {
+    forget_level(&watch->levels[i]);
+    snprintf(path, sizeof(path), "%s/level_%zu.json", watch->dir, i);
+    unlink(path);
+  }
+  if (num_levels > watch->num_levels) {
+    struct WatchedLevel *grown =
+        realloc(watch->levels, num_levels * sizeof(struct WatchedLevel));
+    if (grown == NULL)
+      return RES_OUT_OF_MEMORY;
+    memset(grown + watch->num_levels, 0,
+           (num_levels - watch->num_levels) * sizeof(struct WatchedLevel));
+    watch->levels = grown;
+  }
+  watch->num_levels = num_levels;
+  return RES_OK;
+}
+
+// Writes the changed levels and the manifest of a decoded map
+static RESULT write_update(struct Watch *watch, GmmChunkArray *chunks,
+                           const unsigned int *changed, size_t num_changed,
+                           const uint64_t *hashes, GmmSession *session) {
+  GmmError *error = &session->error;
+  GmmChunkRefArray levels;
+  if (chunk_ref_array_init_in(&levels, &session->arena, 16) < 0 ||
+      shard_collect_levels(chunks, &levels) < 0) {
+    gmm_set_error(error, RES_OUT_OF_MEMORY, "Out of memory");
+    return RES_OUT_OF_MEMORY;
+  }
+  if (levels.len != num_changed) {
+    gmm_set_error(error, RES_BAD_INPUT, "The levels of %s are damaged",
+                  watch->path);
+    return RES_BAD_INPUT;
+  }
+  for (size_t i = 0; i < num_changed; ++i) {
+    GmmChunk *chunk = levels.data[i];
+    struct WatchedLevel *level = &watch->levels[changed[i]];
+    // a level that failed is written again by the next update
+    level->raw_hash = 0;
+    if (shard_write_level(watch->dir, changed[i], chunk, watch->opts,
+                          &level->entry, error) < 0)
+      return error->code;
+    level->has_prop = level->entry.prop != NULL;
+    if (level->has_prop) {
+      const RiffChunkLevelProperties *prop = level->entry.prop;
+      set_string(&level->prop.location_name, &prop->location_name);
+      set_string(&level->prop.level_name, &prop->level_name);
+      level->prop.elevation = prop->elevation;
+      level->prop.num_rows = prop->num_rows;
+      level->prop.num_columns = prop->num_columns;
+    }
+    level->raw_hash = hashes[changed[i]];
+  }
+
+  size_t entries_size = (watch->num_levels + 1) * sizeof(ShardLevel);
+  ShardLevel *entries = arena_alloc(&session->arena, entries_size);
+  if (entries == NULL) {
+    gmm_set_error(error, RES_OUT_OF_MEMORY, "Out of memory");
+    return RES_OUT_OF_MEMORY;
+  }
+  for (size_t i = 0; i < watch->num_levels; ++i) {
+    entries[i] = watch->levels[i].entry;
+    entries[i].prop = watch->levels[i].has_prop ? &watch->levels[i].prop : NULL;
+  }
+  return shard_write_manifest(watch->dir, chunks, entries, watch->num_levels,
+                              watch->opts, error);
+}
+
+// Reads the file and updates the shards of the levels that changed.
+// *updated is set to the number of level files that were written, or -1 if
+// the file didn't change at all.
+static RESULT update_shards(struct Watch *watch, long *updated,
+                            GmmError *error) {
+  Context ctx = {(char *)watch->path};
+  GmmSession session;
+  RiffFile data;
+  uint64_t *hashes = NULL;
+  unsigned int *changed = NULL;
+  gmm_session_init_with(&session, watch->opts->allocator);
+  // The file is read instead of mapped, an editor may truncate it while we
+  // look at it
+  FILE *file = fopen(watch->path, "rb");
+  if (file == NULL) {
+    gmm_set_error(error, RES_ERR, "Cannot open file %s", watch->path);
+    gmm_session_release(&session);
+    return RES_ERR;
+  }
+  RESULT res = read_riff(file, &ctx, &session, &data);
+  fclose(file);
+  if (res < 0) {
+    *error = session.error;
+    gmm_session_release(&session);
+    return res;
+  }
+
+  uint64_t file_hash = xxh64(data.data, data.length, 0);
+  *updated = -1;
+  if (watch->exported && file_hash == watch->file_hash)
+    goto done;
+  long num_levels = hash_levels(&data, &hashes);
+  if (num_levels < 0 ||
+      (changed = malloc(((size_t)num_levels + 1) * sizeof(unsigned int))) ==
+          NULL ||
+      resize_levels(watch, (size_t)num_levels) < 0) {
+    gmm_set_error(&session.error, RES_OUT_OF_MEMORY, "Out of memory");
+    goto done;
+  }
+  size_t num_changed = 0;
+  for (long i = 0; i < num_levels; ++i) {
+    if (watch->levels[i].raw_hash != hashes[i] || !watch->exported)
+      changed[num_changed++] = (unsigned int)i;
+  }
+  // Only the changed levels are decoded. If none changed, the selection
+  // has an index that doesn't exist, so the map chunks are decoded alone.
+  GmmSelection selection = {changed, num_changed, NULL, 0, GMM_LAYERS_ALL};
+  if (num_changed == 0) {
+    changed[0] = UINT_MAX;
+    selection.num_level_indices = 1;
+  }
+  if (watch->opts->selection != NULL)
+    selection.layers = watch->opts->selection->layers;
+  session.flags |= GMM_DECODE_STRING_VIEWS;
+  session.threads = watch->opts->threads > 0 ? watch->opts->threads : 1;
+  session.selection = &selection;
+  if (session.threads == 1)
+    session.flags |= GMM_DECODE_LAZY_CELLS;
+  GmmChunkArray chunks;
+  if (decode_chunks(&data, &session, &chunks) < 0 ||
+      write_update(watch, &chunks, changed, num_changed, hashes, &session) < 0)
+    goto done;
+  watch->file_hash = file_hash;
+  watch->exported = true;
+  *updated = (long)num_changed;
+
+done:
+  res = session.error.code;
+  if (res < 0)
+    *error = session.error;
+  free(changed);
+  free(hashes);
+  gmm_session_release(&session);
+  free_gmmfile(&data);
+  return res;
+}
+
+// Updates the shards and prints what happened
+static void run_update(struct Watch *watch) {
+  GmmError error = {RES_OK, ""};
+  long updated;
+  double start = now();
+  if (update_shards(watch, &updated, &error) < 0) {
+    fprintf(stderr, "%s\n", error.message);
+    return;
+  }
+  if (updated >= 0)
+    fprintf(stderr, "Updated %ld of %zu levels in %.1f ms\n", updated,
+            watch->num_levels, (now() - start) * 1000);
+}
+
+#ifdef __linux__
+// Waits until the watched file is written. Returns false if the events
+// can't be read.
+static bool wait_for_save(int fd, const char *name) {
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool saved = false;
+  int timeout = -1;
+  // after the first event for the file, wait until the events settle down
+  while (true) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, timeout);
+    if (ready < 0 && errno != EINTR)
+      return false;
+    if (ready == 0)
+      return true;
+    if (ready < 0)
+      continue;
+    ssize_t len = read(fd, buffer, sizeof(buffer));
+    if (len < 0) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      return false;
+    }
+    for (char *pos = buffer; pos < buffer + len;) {
+      const struct inotify_event *event = (const struct inotify_event *)pos;
+      if (event->len > 0 && strcmp(event->name, name) == 0)
+        saved = true;
+      pos += sizeof(struct inotify_event) + event->len;
+    }
+    if (saved)
+      timeout = WATCH_SETTLE_MS;
+  }
+}
+
+int watch_shards(const char *path, const char *dir,
+                 const ConvertOptions *opts) {
+  struct Watch watch = {path, dir, opts, 0, false, NULL, 0};
+  if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Couldn't create %s: %s\n", dir, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  // The directory is watched, editors often save by replacing the file
+  char parent[PATH_MAX];
+  const char *name = strrchr(path, '/');
+  if (name != NULL) {
+    snprintf(parent, sizeof(parent), "%.*s", (int)(name - path + 1), path);
+    name++;
+  } else {
+    snprintf(parent, sizeof(parent), ".");
+    name = path;
+  }
+  int fd = inotify_init1(IN_CLOEXEC);
+  if (fd < 0 ||
+      inotify_add_watch(fd, parent, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    fprintf(stderr, "Couldn't watch %s: %s\n", path, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return EXIT_FAILURE;
+  }
+
+  run_update(&watch);
+  fprintf(stderr, "Watching %s for changes\n", path);
+  while (wait_for_save(fd, name))
+    run_update(&watch);
+  fprintf(stderr, "Couldn't watch %s: %s\n", path, strerror(errno));
+  close(fd);
+  for (size_t i = 0; i < watch.num_levels; ++i)
+    forget_level(&watch.levels[i]);
+  free(watch.levels);
+  return EXIT_FAILURE;
+}
+#else
+int watch_shards(const char *path, const char *dir,
+                 const ConvertOptions *opts) {
+  fprintf(stderr, "Watching files needs inotify, which is only available on "
+                  "Linux\n");
+  return EXIT_FAILURE;
+}
+#endif
@@ -0,0 +1,34 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "convert.h"
+
+// Converts the map at path into shards in dir, like convert_shards, then
+// waits for the file to be saved again and updates the shards. Only the
+// levels whose bytes in the file changed are decoded and written again, the
+// manifest is rewritten on every change. Progress and errors of single
+// updates are printed to stderr. Returns EXIT_FAILURE if the file can't be
+// watched, otherwise it runs until the process is stopped.
+int watch_shards(const char *path, const char *dir,
+                 const ConvertOptions *opts);
+
+#endif // WATCH_H
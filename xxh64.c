@@ -0,0 +1,141 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#include <string.h>
+
+#include "xxh64.h"
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+// little endian loads, like the rest of the GMM decoding
+static uint64_t read64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input) {
+  acc += input * PRIME2;
+  acc = rotl(acc, 31);
+  return acc * PRIME1;
+}
+
+static uint64_t merge_round(uint64_t hash, uint64_t acc) {
+  hash ^= round64(0, acc);
+  return hash * PRIME1 + PRIME4;
+}
+
+// Consumes whole 32 byte stripes, returns the end of the consumed input.
+static const uint8_t *consume_stripes(uint64_t acc[4], const uint8_t *p,
+                                      const uint8_t *end) {
+  while (end - p >= 32) {
+    acc[0] = round64(acc[0], read64(p));
+    acc[1] = round64(acc[1], read64(p + 8));
+    acc[2] = round64(acc[2], read64(p + 16));
+    acc[3] = round64(acc[3], read64(p + 24));
+    p += 32;
+  }
+  return p;
+}
+
+void xxh64_init(Xxh64State *state, uint64_t seed) {
+  memset(state, 0, sizeof(Xxh64State));
+  state->seed = seed;
+  state->acc[0] = seed + PRIME1 + PRIME2;
+  state->acc[1] = seed + PRIME2;
+  state->acc[2] = seed;
+  state->acc[3] = seed - PRIME1;
+}
+
+void xxh64_update(Xxh64State *state, const void *data, size_t len) {
+  const uint8_t *p = data;
+  const uint8_t *end = p + len;
+  state->total_len += len;
+  if (state->mem_size + len < 32) {
+    memcpy(state->mem + state->mem_size, p, len);
+    state->mem_size += len;
+    return;
+  }
+  if (state->mem_size > 0) {
+    size_t fill = 32 - state->mem_size;
+    memcpy(state->mem + state->mem_size, p, fill);
+    consume_stripes(state->acc, state->mem, state->mem + 32);
+    p += fill;
+    state->mem_size = 0;
+  }
+  p = consume_stripes(state->acc, p, end);
+  memcpy(state->mem, p, (size_t)(end - p));
+  state->mem_size = (size_t)(end - p);
+}
+
+uint64_t xxh64_digest(const Xxh64State *state) {
+  uint64_t hash;
+  if (state->total_len >= 32) {
+    const uint64_t *acc = state->acc;
+    hash = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) +
+           rotl(acc[3], 18);
+    for (int i = 0; i < 4; ++i)
+      hash = merge_round(hash, acc[i]);
+  } else {
+    hash = state->seed + PRIME5;
+  }
+  hash += state->total_len;
+
+  const uint8_t *p = state->mem;
+  const uint8_t *end = p + state->mem_size;
+  for (; end - p >= 8; p += 8) {
+    hash ^= round64(0, read64(p));
+    hash = rotl(hash, 27) * PRIME1 + PRIME4;
+  }
+  if (end - p >= 4) {
+    hash ^= (uint64_t)read32(p) * PRIME1;
+    hash = rotl(hash, 23) * PRIME2 + PRIME3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    hash ^= *p * PRIME5;
+    hash = rotl(hash, 11) * PRIME1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= PRIME2;
+  hash ^= hash >> 29;
+  hash *= PRIME3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed) {
+  Xxh64State state;
+  xxh64_init(&state, seed);
+  xxh64_update(&state, data, len);
+  return xxh64_digest(&state);
+}
@@ -0,0 +1,44 @@
+/*
+    gmm2json: program that reads Gridmonger's GMM file and converts it into
+   JSON format
+    Copyright (C) 2025 Jagholin (github.com/Jagholin)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see
+   <https://www.gnu.org/licenses/>
+*/
+#ifndef XXH64_H
+#define XXH64_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// XXH64, the 64 bit variant of the xxHash non-cryptographic hash. Used to
+// tell whether two outputs (or inputs) have the same content.
+typedef struct Xxh64State {
+  uint64_t total_len;
+  uint64_t acc[4];
+  uint8_t mem[32]; // input that doesn't fill a stripe yet
+  size_t mem_size;
+  uint64_t seed;
+} Xxh64State;
+
+void xxh64_init(Xxh64State *state, uint64_t seed);
+void xxh64_update(Xxh64State *state, const void *data, size_t len);
+// Hash of all data passed to xxh64_update so far. The state can be updated
+// further afterwards.
+uint64_t xxh64_digest(const Xxh64State *state);
+// Hash of a single buffer
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
+
+#endif // XXH64_H